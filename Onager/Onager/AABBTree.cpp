@@ -0,0 +1,616 @@
+#include "AABBTree.h"
+#include "Body.h"
+#include "Collider.h"
+
+
+namespace ong
+{
+
+	static inline AABB merge(const AABB& a, const AABB& b)
+	{
+		AABB result = a;
+		mergeAABBAABB(&result, (AABB*)&b);
+		return result;
+	}
+
+	// proportional to the surface area
+	static inline float area(const AABB& a)
+	{
+		return a.e.x * a.e.y + a.e.y * a.e.z + a.e.z * a.e.x;
+	}
+
+
+	AABBTree::Tree::Tree()
+		: root(NULL_NODE),
+		freeList(NULL_NODE)
+	{
+	}
+
+
+	AABBTree::AABBTree()
+		: m_proxyIDAllocator(128 / sizeof(ProxyID))
+	{
+	}
+
+	AABBTree::Tree& AABBTree::getTree(const ProxyID* id)
+	{
+		return id->pBody->getType() == BodyType::Static ? m_static : m_dynamic;
+	}
+
+
+	int AABBTree::allocateNode(Tree& tree)
+	{
+		int node;
+		if (tree.freeList == NULL_NODE)
+		{
+			node = (int)tree.nodes.size();
+			tree.nodes.push_back(Node());
+		}
+		else
+		{
+			node = tree.freeList;
+			tree.freeList = tree.nodes[node].next;
+		}
+
+		Node& n = tree.nodes[node];
+		n.parent = NULL_NODE;
+		n.left = NULL_NODE;
+		n.right = NULL_NODE;
+		n.height = 0;
+		n.id = nullptr;
+
+		return node;
+	}
+
+	void AABBTree::freeNode(Tree& tree, int node)
+	{
+		tree.nodes[node].next = tree.freeList;
+		tree.nodes[node].height = -1;
+		tree.freeList = node;
+	}
+
+
+	const ProxyID* AABBTree::addBody(Body* pBody)
+	{
+		ProxyID* id = m_proxyIDAllocator();
+		id->pBody = pBody;
+		id->level = 0;
+		updateFilter(id);
+
+		Tree& tree = getTree(id);
+
+		int leaf = allocateNode(tree);
+		tree.nodes[leaf].aabb = calculateFatAABB(pBody->getAABB(), vec3(0.0f, 0.0f, 0.0f));
+		tree.nodes[leaf].id = id;
+
+		insertLeaf(tree, leaf);
+
+		id->idx = leaf;
+
+		return id;
+	}
+
+	void AABBTree::removeBody(const ProxyID* pProxyID)
+	{
+		Tree& tree = getTree(pProxyID);
+
+		ProxyID* id = tree.nodes[pProxyID->idx].id;
+
+		removeLeaf(tree, pProxyID->idx);
+		freeNode(tree, pProxyID->idx);
+
+		m_proxyIDAllocator.sDelete(id);
+	}
+
+	void AABBTree::updateBody(const ProxyID* pProxyID, const vec3& displacement)
+	{
+		const AABB& aabb = pProxyID->pBody->getAABB();
+
+		Tree& tree = getTree(pProxyID);
+		int leaf = pProxyID->idx;
+
+		updateFilter(tree.nodes[leaf].id);
+
+		if (contains(tree.nodes[leaf].aabb, aabb))
+			return;
+
+		// the leaf keeps its index, only its parent is replaced
+		removeLeaf(tree, leaf);
+		tree.nodes[leaf].aabb = calculateFatAABB(aabb, displacement);
+		insertLeaf(tree, leaf);
+	}
+
+
+	void AABBTree::insertLeaf(Tree& tree, int leaf)
+	{
+		if (tree.root == NULL_NODE)
+		{
+			tree.root = leaf;
+			tree.nodes[leaf].parent = NULL_NODE;
+			return;
+		}
+
+		// find the best sibling with the surface area heuristic
+		AABB leafAABB = tree.nodes[leaf].aabb;
+		int index = tree.root;
+		while (tree.nodes[index].height > 0)
+		{
+			const Node& n = tree.nodes[index];
+
+			float nodeArea = area(n.aabb);
+			float combinedArea = area(merge(n.aabb, leafAABB));
+
+			// cost of a new parent for this node and the leaf
+			float cost = 2.0f * combinedArea;
+			// minimum cost of pushing the leaf further down
+			float inheritanceCost = 2.0f * (combinedArea - nodeArea);
+
+			float costLeft = area(merge(tree.nodes[n.left].aabb, leafAABB)) + inheritanceCost;
+			if (tree.nodes[n.left].height > 0)
+				costLeft -= area(tree.nodes[n.left].aabb);
+
+			float costRight = area(merge(tree.nodes[n.right].aabb, leafAABB)) + inheritanceCost;
+			if (tree.nodes[n.right].height > 0)
+				costRight -= area(tree.nodes[n.right].aabb);
+
+			if (cost < costLeft && cost < costRight)
+				break;
+
+			index = costLeft < costRight ? n.left : n.right;
+		}
+
+		int sibling = index;
+
+		// may reallocate the nodes
+		int newParent = allocateNode(tree);
+
+		int oldParent = tree.nodes[sibling].parent;
+		tree.nodes[newParent].parent = oldParent;
+		tree.nodes[newParent].aabb = merge(leafAABB, tree.nodes[sibling].aabb);
+		tree.nodes[newParent].height = tree.nodes[sibling].height + 1;
+		tree.nodes[newParent].left = sibling;
+		tree.nodes[newParent].right = leaf;
+		tree.nodes[sibling].parent = newParent;
+		tree.nodes[leaf].parent = newParent;
+
+		if (oldParent == NULL_NODE)
+			tree.root = newParent;
+		else if (tree.nodes[oldParent].left == sibling)
+			tree.nodes[oldParent].left = newParent;
+		else
+			tree.nodes[oldParent].right = newParent;
+
+		// refit and rebalance the ancestors
+		index = tree.nodes[leaf].parent;
+		while (index != NULL_NODE)
+		{
+			index = balance(tree, index);
+
+			Node& n = tree.nodes[index];
+			n.height = 1 + ong_MAX(tree.nodes[n.left].height, tree.nodes[n.right].height);
+			n.aabb = merge(tree.nodes[n.left].aabb, tree.nodes[n.right].aabb);
+
+			index = n.parent;
+		}
+	}
+
+	void AABBTree::removeLeaf(Tree& tree, int leaf)
+	{
+		if (leaf == tree.root)
+		{
+			tree.root = NULL_NODE;
+			return;
+		}
+
+		int parent = tree.nodes[leaf].parent;
+		int grandParent = tree.nodes[parent].parent;
+		int sibling = tree.nodes[parent].left == leaf ? tree.nodes[parent].right : tree.nodes[parent].left;
+
+		freeNode(tree, parent);
+
+		if (grandParent == NULL_NODE)
+		{
+			tree.root = sibling;
+			tree.nodes[sibling].parent = NULL_NODE;
+			return;
+		}
+
+		// the sibling takes the place of the parent
+		if (tree.nodes[grandParent].left == parent)
+			tree.nodes[grandParent].left = sibling;
+		else
+			tree.nodes[grandParent].right = sibling;
+		tree.nodes[sibling].parent = grandParent;
+
+		int index = grandParent;
+		while (index != NULL_NODE)
+		{
+			index = balance(tree, index);
+
+			Node& n = tree.nodes[index];
+			n.height = 1 + ong_MAX(tree.nodes[n.left].height, tree.nodes[n.right].height);
+			n.aabb = merge(tree.nodes[n.left].aabb, tree.nodes[n.right].aabb);
+
+			index = n.parent;
+		}
+	}
+
+
+	// rotates the higher child of a up if the subtrees differ by more than one level,
+	// returns the new root of the subtree
+	int AABBTree::balance(Tree& tree, int a)
+	{
+		std::vector<Node>& nodes = tree.nodes;
+
+		if (nodes[a].height < 2)
+			return a;
+
+		int b = nodes[a].left;
+		int c = nodes[a].right;
+
+		int balance = nodes[c].height - nodes[b].height;
+
+		// rotate c up
+		if (balance > 1)
+		{
+			int f = nodes[c].left;
+			int g = nodes[c].right;
+
+			nodes[c].left = a;
+			nodes[c].parent = nodes[a].parent;
+			nodes[a].parent = c;
+
+			if (nodes[c].parent == NULL_NODE)
+				tree.root = c;
+			else if (nodes[nodes[c].parent].left == a)
+				nodes[nodes[c].parent].left = c;
+			else
+				nodes[nodes[c].parent].right = c;
+
+			// the higher grandchild stays with c
+			if (nodes[f].height > nodes[g].height)
+			{
+				nodes[c].right = f;
+				nodes[a].right = g;
+				nodes[g].parent = a;
+			}
+			else
+			{
+				nodes[c].right = g;
+				nodes[a].right = f;
+				nodes[f].parent = a;
+			}
+
+			int moved = nodes[a].right;
+			nodes[a].aabb = merge(nodes[b].aabb, nodes[moved].aabb);
+			nodes[a].height = 1 + ong_MAX(nodes[b].height, nodes[moved].height);
+
+			int kept = nodes[c].right;
+			nodes[c].aabb = merge(nodes[a].aabb, nodes[kept].aabb);
+			nodes[c].height = 1 + ong_MAX(nodes[a].height, nodes[kept].height);
+
+			return c;
+		}
+
+		// rotate b up
+		if (balance < -1)
+		{
+			int d = nodes[b].left;
+			int e = nodes[b].right;
+
+			nodes[b].left = a;
+			nodes[b].parent = nodes[a].parent;
+			nodes[a].parent = b;
+
+			if (nodes[b].parent == NULL_NODE)
+				tree.root = b;
+			else if (nodes[nodes[b].parent].left == a)
+				nodes[nodes[b].parent].left = b;
+			else
+				nodes[nodes[b].parent].right = b;
+
+			if (nodes[d].height > nodes[e].height)
+			{
+				nodes[b].right = d;
+				nodes[a].left = e;
+				nodes[e].parent = a;
+			}
+			else
+			{
+				nodes[b].right = e;
+				nodes[a].left = d;
+				nodes[d].parent = a;
+			}
+
+			int moved = nodes[a].left;
+			nodes[a].aabb = merge(nodes[c].aabb, nodes[moved].aabb);
+			nodes[a].height = 1 + ong_MAX(nodes[c].height, nodes[moved].height);
+
+			int kept = nodes[b].right;
+			nodes[b].aabb = merge(nodes[a].aabb, nodes[kept].aabb);
+			nodes[b].height = 1 + ong_MAX(nodes[a].height, nodes[kept].height);
+
+			return b;
+		}
+
+		return a;
+	}
+
+
+	void AABBTree::queryAABB(const Tree& tree, const AABB& aabb)
+	{
+		m_result.clear();
+
+		if (tree.root == NULL_NODE)
+			return;
+
+		m_stack.clear();
+		m_stack.push_back(tree.root);
+
+		while (!m_stack.empty())
+		{
+			int index = m_stack.back();
+			m_stack.pop_back();
+
+			const Node& n = tree.nodes[index];
+
+			if (!overlap(&n.aabb, &aabb))
+				continue;
+
+			if (n.height == 0)
+			{
+				m_result.push_back(index);
+			}
+			else
+			{
+				m_stack.push_back(n.right);
+				m_stack.push_back(n.left);
+			}
+		}
+	}
+
+
+	int AABBTree::generatePairs(std::vector<Pair>* pairs, JobSystem* /*jobSystem*/)
+	{
+		size_t start = pairs->size();
+
+		// only dynamic leaves search for pairs, static ones are found from the dynamic side
+		for (int i = 0; i < (int)m_dynamic.nodes.size(); ++i)
+		{
+			const Node& leaf = m_dynamic.nodes[i];
+			if (leaf.height != 0)
+				continue;
+
+			Body* a = leaf.id->pBody;
+
+			queryAABB(m_dynamic, leaf.aabb);
+			for (int j = 0; j < (int)m_result.size(); ++j)
+			{
+				// every pair once
+				if (m_result[j] <= i)
+					continue;
+
+				const ProxyID* other = m_dynamic.nodes[m_result[j]].id;
+				if (isFiltered(leaf.id, other))
+					continue;
+
+				Body* b = other->pBody;
+
+				// sleeping bodies do not collide with each other
+				if (!a->isActive() && !b->isActive())
+					continue;
+
+				if (overlap(&a->getAABB(), &b->getAABB()))
+					pairs->push_back(Pair{ a, b });
+			}
+
+			if (!a->isActive())
+				continue;
+
+			queryAABB(m_static, leaf.aabb);
+			for (int j = 0; j < (int)m_result.size(); ++j)
+			{
+				const ProxyID* other = m_static.nodes[m_result[j]].id;
+				if (isFiltered(leaf.id, other))
+					continue;
+
+				Body* b = other->pBody;
+
+				if (overlap(&a->getAABB(), &b->getAABB()))
+					pairs->push_back(Pair{ a, b });
+			}
+		}
+
+		return (int)(pairs->size() - start);
+	}
+
+
+	bool AABBTree::queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax)
+	{
+		bool hitDynamic = queryRay(m_dynamic, origin, dir, hit, tmax);
+		if (hitDynamic)
+			tmax = hit->t;
+
+		RayQueryResult staticHit;
+		if (queryRay(m_static, origin, dir, &staticHit, tmax))
+		{
+			*hit = staticHit;
+			return true;
+		}
+
+		return hitDynamic;
+	}
+
+	bool AABBTree::queryRay(const Tree& tree, const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax)
+	{
+		if (tree.root == NULL_NODE)
+			return false;
+
+		RayQueryResult minResult;
+		minResult.collider = 0;
+		minResult.t = tmax;
+
+		m_stack.clear();
+		m_stack.push_back(tree.root);
+
+		while (!m_stack.empty())
+		{
+			int index = m_stack.back();
+			m_stack.pop_back();
+
+			const Node& n = tree.nodes[index];
+
+			float tmin;
+			vec3 p;
+			if (!intersectRayAABB(origin, dir, n.aabb, tmin, p) || tmin > minResult.t)
+				continue;
+
+			if (n.height == 0)
+			{
+				RayQueryResult result = { 0 };
+				if (n.id->pBody->queryRay(origin, dir, &result, minResult.t) && result.t < minResult.t)
+					minResult = result;
+			}
+			else
+			{
+				m_stack.push_back(n.right);
+				m_stack.push_back(n.left);
+			}
+		}
+
+		if (minResult.collider == 0)
+			return false;
+
+		*hit = minResult;
+		return true;
+	}
+
+
+	bool AABBTree::queryOcclusion(const vec3& origin, const vec3& dir, float tmax)
+	{
+		return queryOcclusion(m_static, origin, dir, tmax) || queryOcclusion(m_dynamic, origin, dir, tmax);
+	}
+
+	bool AABBTree::queryOcclusion(const Tree& tree, const vec3& origin, const vec3& dir, float tmax)
+	{
+		if (tree.root == NULL_NODE)
+			return false;
+
+		m_stack.clear();
+		m_stack.push_back(tree.root);
+
+		while (!m_stack.empty())
+		{
+			int index = m_stack.back();
+			m_stack.pop_back();
+
+			const Node& n = tree.nodes[index];
+
+			float tmin;
+			vec3 p;
+			if (!intersectRayAABB(origin, dir, n.aabb, tmin, p) || tmin > tmax)
+				continue;
+
+			if (n.height == 0)
+			{
+				if (n.id->pBody->queryOcclusion(origin, dir, tmax))
+					return true;
+			}
+			else
+			{
+				m_stack.push_back(n.right);
+				m_stack.push_back(n.left);
+			}
+		}
+
+		return false;
+	}
+
+
+	bool AABBTree::queryCollider(const Collider* collider)
+	{
+		AABB aabb = calculateColliderAABB(collider);
+
+		Tree* trees[] = { &m_dynamic, &m_static };
+		for (Tree* tree : trees)
+		{
+			queryAABB(*tree, aabb);
+			for (int i = 0; i < (int)m_result.size(); ++i)
+			{
+				Body* body = tree->nodes[m_result[i]].id->pBody;
+
+				if (collider->getBody() == body)
+					continue;
+				if (body->queryCollider(collider))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool AABBTree::queryCollider(Collider* collider, ColliderQueryCallBack callback)
+	{
+		AABB aabb = calculateColliderAABB(collider);
+
+		bool hit = false;
+
+		Tree* trees[] = { &m_dynamic, &m_static };
+		for (Tree* tree : trees)
+		{
+			queryAABB(*tree, aabb);
+			for (int i = 0; i < (int)m_result.size(); ++i)
+			{
+				Body* body = tree->nodes[m_result[i]].id->pBody;
+
+				if (collider->getBody() == body)
+					continue;
+				if (!body->queryCollider(collider, callback))
+					return true;
+				else hit = true;
+			}
+		}
+
+		return hit;
+	}
+
+	bool AABBTree::queryShape(ShapePtr shape, const Transform& transform)
+	{
+		AABB aabb = calculateAABB(shape, transform);
+
+		Tree* trees[] = { &m_dynamic, &m_static };
+		for (Tree* tree : trees)
+		{
+			queryAABB(*tree, aabb);
+			for (int i = 0; i < (int)m_result.size(); ++i)
+			{
+				if (tree->nodes[m_result[i]].id->pBody->queryShape(shape, transform))
+					return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool AABBTree::queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData)
+	{
+		AABB aabb = calculateAABB(shape, transform);
+
+		bool hit = false;
+
+		Tree* trees[] = { &m_dynamic, &m_static };
+		for (Tree* tree : trees)
+		{
+			queryAABB(*tree, aabb);
+			for (int i = 0; i < (int)m_result.size(); ++i)
+			{
+				if (!tree->nodes[m_result[i]].id->pBody->queryShape(shape, transform, callback, userData))
+					return true;
+				else hit = true;
+			}
+		}
+
+		return hit;
+	}
+
+}
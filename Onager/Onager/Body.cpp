@@ -2,6 +2,7 @@
 #include "World.h"
 #include "Narrowphase.h"
 #include "BVH.h"
+#include "RayPacket.h"
 
 namespace ong
 {
@@ -11,12 +12,15 @@ namespace ong
 		: m_pWorld(pWorld),
 		m_index(idx),
 		m_flags(0),
+		m_sleepTime(0.0f),
 		m_pCollider(nullptr),
 		m_cm(0.0f, 0.0f, 0.0f),
 		m_numContacts(0),
 		m_pContacts(nullptr),
 		m_tree(nullptr),
-		m_numCollider(0)
+		m_numCollider(0),
+		m_collisionGroup(0),
+		m_collisionFilter(0)
 	{
 
 		m_aabb = {vec3(0, 0, 0), vec3(0,0,0)};
@@ -35,6 +39,8 @@ namespace ong
 
 		assert(pCollider->getBody() == NULL);
 
+		wakeUp();
+
 		pCollider->setBody(this);
 
 		m_numCollider++;
@@ -54,6 +60,7 @@ namespace ong
 			calculateTree();
 		}
 		calculateAABB();
+		calculateCollisionFilter();
 		m_pWorld->updateProxy(m_proxyID);
 	}
 
@@ -61,6 +68,8 @@ namespace ong
 	{
 		assert(collider->getBody() == this);
 
+		wakeUp();
+
 		m_numCollider--;
 
 		if (collider->getNext())
@@ -76,13 +85,16 @@ namespace ong
 		ContactIter* iter = m_pContacts;
 		while (iter)
 		{
+			ContactIter* next = iter->next;
 			if (iter->contact->colliderA == collider || iter->contact->colliderB == collider)
 			{
 				m_pWorld->removeContact(iter->contact);
 			}
-			iter = iter->next;
+			iter = next;
 		}
 
+		m_pWorld->removeCollider(collider);
+
 		collider->setBody(nullptr);
 
 		if (m_numCollider != 0)
@@ -93,12 +105,33 @@ namespace ong
 			calculateTree();
 		}
 		calculateAABB();
+		calculateCollisionFilter();
 		m_pWorld->updateProxy(m_proxyID);
 
 	}
 
 
 
+	void Body::calculateCollisionFilter()
+	{
+		if (m_pCollider == nullptr)
+		{
+			m_collisionGroup = 0;
+			m_collisionFilter = 0;
+			return;
+		}
+
+		m_collisionGroup = ~0u;
+		m_collisionFilter = ~0u;
+
+		for (Collider* c = m_pCollider; c != nullptr; c = c->getNext())
+		{
+			m_collisionGroup &= c->getCollisionGroup();
+			m_collisionFilter &= c->getCollisionFilter();
+		}
+	}
+
+
 	void Body::calculateMassData()
 	{
 		float m = 0.0f;
@@ -370,6 +403,219 @@ namespace ong
 		return (result->collider != nullptr);
 	}
 
+	// tests the collider against the lanes in mask, o and d are in body space.
+	// hits before tmin update tmin and the collider and normal of the lane
+	static int intersectRaysCollider(Collider* c, const vec3* o, const vec3* d, int count, int mask, float* tmin, RayQueryResult* hits)
+	{
+		const Transform& t = c->getTransform();
+
+		vec3 _o[RAY_PACKET_SIZE], _d[RAY_PACKET_SIZE];
+		for (int l = 0; l < count; ++l)
+		{
+			_o[l] = invTransformVec3(o[l], t);
+			_d[l] = rotate(d[l], conjugate(t.q));
+		}
+
+		int hitMask = 0;
+
+		if (c->getShape().getType() == ShapeType::SPHERE)
+		{
+			const Sphere* sphere = c->getShape();
+
+			RayPacket packet;
+			setRayPacket(&packet, _o, _d, count);
+
+			__m128 tSphere;
+			int sphereMask = intersectRayPacketSphere(packet, sphere, &tSphere) & mask;
+
+			for (int l = 0; l < count; ++l)
+			{
+				float tl = getRayPacketLane(tSphere, l);
+				if ((sphereMask & (1 << l)) == 0 || tl >= tmin[l])
+					continue;
+
+				vec3 p = _o[l] + tl * _d[l];
+
+				tmin[l] = tl;
+				hits[l].collider = c;
+				hits[l].normal = rotate(p - sphere->c, t.q);
+				hitMask |= 1 << l;
+			}
+
+			return hitMask;
+		}
+
+		// hulls and capsules are tested one ray at a time
+		for (int l = 0; l < count; ++l)
+		{
+			if ((mask & (1 << l)) == 0)
+				continue;
+
+			float tl;
+			vec3 p, n;
+			bool hit = false;
+			switch (c->getShape().getType())
+			{
+			case ShapeType::HULL:
+				hit = intersectRayHull(_o[l], _d[l], c->getShape(), tl, p, n);
+				break;
+			case ShapeType::CAPSULE:
+				hit = intersectRayCapsule(_o[l], _d[l], c->getShape(), tl, p, n);
+				break;
+			}
+
+			if (hit && tl < tmin[l])
+			{
+				tmin[l] = tl;
+				hits[l].collider = c;
+				hits[l].normal = rotate(n, t.q);
+				hitMask |= 1 << l;
+			}
+		}
+
+		return hitMask;
+	}
+
+	int Body::queryRays(const Ray* rays, int count, int mask, RayQueryResult* hits, float* tmax)
+	{
+		assert(count <= RAY_PACKET_SIZE);
+
+		Transform t = getTransform();
+
+		vec3 o[RAY_PACKET_SIZE], d[RAY_PACKET_SIZE];
+		float tmin[RAY_PACKET_SIZE] = { 0.0f };
+		RayQueryResult result[RAY_PACKET_SIZE];
+		for (int l = 0; l < count; ++l)
+		{
+			o[l] = invTransformVec3(rays[l].origin, t);
+			d[l] = rotate(rays[l].dir, conjugate(t.q));
+			tmin[l] = tmax[l];
+		}
+
+		RayPacket packet;
+		setRayPacket(&packet, o, d, count);
+
+		int hitMask = 0;
+
+		if (m_numCollider > 1)
+		{
+			// the whole packet walks the tree, a node is entered if any lane still hits its box
+			std::stack<BVTree*> s;
+			s.push(m_tree);
+
+			while (!s.empty())
+			{
+				BVTree* n = s.top();
+				s.pop();
+
+				int nodeMask = intersectRayPacketAABB(packet, n->aabb, _mm_loadu_ps(tmin)) & mask;
+				if (nodeMask == 0)
+					continue;
+
+				if (n->type == NodeType::LEAF)
+				{
+					hitMask |= intersectRaysCollider(n->collider, o, d, count, nodeMask, tmin, result);
+				}
+				else
+				{
+					s.push(m_tree + n->right);
+					s.push(m_tree + n->left);
+				}
+			}
+		}
+		else if (m_numCollider == 1)
+		{
+			int aabbMask = intersectRayPacketAABB(packet, m_pCollider->getAABB(), _mm_loadu_ps(tmin)) & mask;
+			if (aabbMask != 0)
+				hitMask = intersectRaysCollider(m_pCollider, o, d, count, aabbMask, tmin, result);
+		}
+
+		for (int l = 0; l < count; ++l)
+		{
+			if ((hitMask & (1 << l)) == 0)
+				continue;
+
+			hits[l].collider = result[l].collider;
+			hits[l].t = tmin[l];
+			hits[l].point = rays[l].origin + tmin[l] * rays[l].dir;
+			hits[l].normal = normalize(rotate(result[l].normal, t.q));
+
+			tmax[l] = tmin[l];
+		}
+
+		return hitMask;
+	}
+
+	static bool intersectRayCollider(const Collider* c, const vec3& o, const vec3& d, float tmax)
+	{
+		const Transform& t = c->getTransform();
+		vec3 _o = invTransformVec3(o, t);
+		vec3 _d = rotate(d, conjugate(t.q));
+
+		switch (c->getShape().getType())
+		{
+		case ShapeType::HULL:
+			return intersectRayHull(_o, _d, c->getShape(), tmax);
+		case ShapeType::SPHERE:
+			return intersectRaySphere(_o, _d, c->getShape(), tmax);
+		case ShapeType::CAPSULE:
+			return intersectRayCapsule(_o, _d, c->getShape(), tmax);
+		}
+
+		return false;
+	}
+
+	static bool occludeTree(BVTree* tree, const vec3& o, const vec3& d, float tmax)
+	{
+		std::stack<BVTree*> s;
+		s.push(tree);
+
+		while (!s.empty())
+		{
+			BVTree* n = s.top();
+			s.pop();
+
+			float t;
+			vec3 p;
+			if (!intersectRayAABB(o, d, n->aabb, t, p) || t > tmax)
+				continue;
+
+			if (n->type == NodeType::LEAF)
+			{
+				if (intersectRayCollider(n->collider, o, d, tmax))
+					return true;
+			}
+			else
+			{
+				s.push(tree + n->right);
+				s.push(tree + n->left);
+			}
+		}
+
+		return false;
+	}
+
+	bool Body::queryOcclusion(const vec3& origin, const vec3& dir, float tmax)
+	{
+		Transform t = getTransform();
+
+		vec3 o = invTransformVec3(origin, t);
+		vec3 d = rotate(dir, conjugate(t.q));
+
+		if (m_numCollider > 1)
+			return occludeTree(m_tree, o, d, tmax);
+
+		if (m_numCollider == 1)
+		{
+			float tmin;
+			vec3 p;
+			return intersectRayAABB(o, d, m_pCollider->getAABB(), tmin, p) && tmin <= tmax &&
+				intersectRayCollider(m_pCollider, o, d, tmax);
+		}
+
+		return false;
+	}
+
 	bool overlap(const Collider* a, const Collider* b)
 	{
 		Transform t2;
@@ -741,35 +987,27 @@ namespace ong
 	}
 
 
-	ContactIter* Body::removeContact(Contact* contact)
+	void Body::removeContact(ContactIter* iter)
 	{
-		for (ContactIter* c = m_pContacts; c != 0; c = c->next)
-		{
-			if (c->contact == contact)
-			{
-				if (c->prev)
-					c->prev->next = c->next;
-				if (c->next)
-					c->next->prev = c->prev;
-
-				if (m_pContacts == c)
-					m_pContacts = c->next;
-				m_numContacts--;
-
-				return c;
-			}
-		}
-
-		assert(true);
-		return 0;
+		if (iter->prev)
+			iter->prev->next = iter->next;
+		if (iter->next)
+			iter->next->prev = iter->prev;
+
+		if (m_pContacts == iter)
+			m_pContacts = iter->next;
+		m_numContacts--;
 	}
 
 
 	void Body::setPosition(const vec3& position)
 	{
+		wakeUp();
+
 		m_pWorld->m_r[m_index].p = position + rotate(m_cm, getOrientation());
 		//m_pWorld->setPosition(m_index, position + m_cm);
 
+		calculateAABB();
 		m_pWorld->updateProxy(m_proxyID);
 	}
 
@@ -777,12 +1015,14 @@ namespace ong
 
 	void Body::applyImpulse(const vec3& impulse, const vec3& point)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].l += impulse;
 		m_pWorld->m_p[m_index].a += cross(point - m_pWorld->m_r[m_index].p, impulse);
 	}
 
 	void Body::applyImpulse(const vec3& impulse)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].l += impulse;
 
 	}
@@ -800,11 +1040,13 @@ namespace ong
 
 	void Body::applyAngularImpulse(const vec3& impulse)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].a += impulse;
 	}
 
 	void Body::applyRelativeAngularImpulse(const vec3& impulse)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].a += rotate(impulse, getOrientation());
 	}
 
@@ -843,13 +1085,37 @@ namespace ong
 
 	void Body::setLinearMomentum(const vec3& momentum)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].l = momentum;
 	}
 
 	void Body::setAngularMomentum(const vec3& momentum)
 	{
+		wakeUp();
 		m_pWorld->m_p[m_index].a = momentum;
 	}
 
 
+	void Body::wakeUp()
+	{
+		if (m_flags & SLEEPING)
+		{
+			m_flags &= ~SLEEPING;
+			m_sleepTime = 0.0f;
+		}
+	}
+
+	void Body::sleep()
+	{
+		if (m_flags & STATIC)
+			return;
+
+		m_flags |= SLEEPING;
+		m_sleepTime = 0.0f;
+
+		m_pWorld->m_v[m_index].v = vec3(0.0f, 0.0f, 0.0f);
+		m_pWorld->m_v[m_index].w = vec3(0.0f, 0.0f, 0.0f);
+		m_pWorld->m_p[m_index].l = vec3(0.0f, 0.0f, 0.0f);
+		m_pWorld->m_p[m_index].a = vec3(0.0f, 0.0f, 0.0f);
+	}
 }
\ No newline at end of file
@@ -1,148 +1,269 @@
 #include "Broadphase.h"
 #include "Body.h"
 #include "Collider.h"
+#include "RayPacket.h"
 #include <algorithm>
+#include <emmintrin.h>
 #include <stack>
 #include "Profiler.h"
+#include "JobSystem.h"
+#include "Settings.h"
 
 
 namespace ong
 {
 
 
+	const float HGrid::DEFAULT_MAX_LOAD_FACTOR = 0.5f;
 	const float HGrid::CELL_TO_CELL_RATIO = 2.0f;
 	const float HGrid::MIN_CELL_SIZE = 1.0f;
 	const float HGrid::SPHERE_TO_CELL_RATIO = 0.5f;
 
 
-	HGrid::HGrid()
-		: m_proxyIDAllocator(128 / sizeof(ProxyID)),
-		m_tick(0),
-		m_occupiedLevelsMask(0),
-		m_minExtend(0, 0, 0),
-		m_maxExtend(0,0,0)
+	int Broadphase::updatePairs(JobSystem* jobSystem)
 	{
-		m_timeStamp;
-		memset(m_timeStamp, 0, sizeof(int) * NUM_BUCKETS);
+		m_pairs.clear();
+		int numPairs = generatePairs(&m_pairs, jobSystem);
 
+		m_pairIDs.resize(numPairs);
+		m_pairManager.update(m_pairs.data(), numPairs, m_pairIDs.data());
 
+		return numPairs;
+	}
+
+	int Broadphase::queryRays(const Ray* rays, int n, RayQueryResult* hits, JobSystem* /*jobSystem*/)
+	{
+		int numHits = 0;
+
+		for (int i = 0; i < n; ++i)
+		{
+			hits[i].collider = nullptr;
+			hits[i].t = rays[i].tmax;
+
+			if (queryRay(rays[i].origin, rays[i].dir, &hits[i], rays[i].tmax))
+				numHits++;
+		}
+
+		return numHits;
+	}
+
+
+	AABB Broadphase::calculateFatAABB(const AABB& aabb, const vec3& displacement)
+	{
+		AABB fat;
+		fat.c = aabb.c;
+		fat.e = aabb.e + vec3(ong_AABB_MARGIN, ong_AABB_MARGIN, ong_AABB_MARGIN);
+
+		// extend in the direction of movement
+		vec3 d = ong_AABB_DISPLACEMENT_MULTIPLIER * displacement;
+		for (int i = 0; i < 3; ++i)
+		{
+			fat.c[i] += 0.5f * d[i];
+			fat.e[i] += 0.5f * abs(d[i]);
+		}
+
+		return fat;
+	}
+
+	AABB Broadphase::calculateColliderAABB(const Collider* collider)
+	{
+		if (collider->getBody())
+			return transformAABB(&collider->getAABB(), &collider->getBody()->getTransform());
+
+		return collider->getAABB();
+	}
+
+	bool Broadphase::contains(const AABB& outer, const AABB& inner)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (inner.c[i] - inner.e[i] < outer.c[i] - outer.e[i] ||
+				inner.c[i] + inner.e[i] > outer.c[i] + outer.e[i])
+				return false;
+		}
+
+		return true;
+	}
+
+	void Broadphase::updateFilter(ProxyID* id)
+	{
+		id->collisionGroup = id->pBody->getCollisionGroup();
+		id->collisionFilter = id->pBody->getCollisionFilter();
+	}
+
+
+	HGrid::Grid::Grid(int numCells)
+		: occupiedLevelsMask(0),
+		cells(numCells),
+		numUsedCells(0),
+		minExtend(0, 0, 0),
+		maxExtend(0, 0, 0)
+	{
+		memset(objectsAtLevel, 0, sizeof(int) * MAX_LEVELS);
+
+		for (Cell& cell : cells)
+			cell.key = EMPTY_CELL;
+	}
+
+
+	static int roundUpToPowerOfTwo(int n)
+	{
+		int p = 1;
+		while (p < n)
+			p <<= 1;
+		return p;
+	}
+
+	HGrid::HGrid(int numCells, float maxLoadFactor)
+		: m_dynamic(roundUpToPowerOfTwo(numCells)),
+		m_static(roundUpToPowerOfTwo(numCells)),
+		m_maxLoadFactor(maxLoadFactor),
+		m_proxyIDAllocator(128 / sizeof(ProxyID))
+	{
+		assert(numCells > 0 && maxLoadFactor > 0.0f && maxLoadFactor < 1.0f);
+	}
+
+	HGrid::Grid& HGrid::getGrid(const ProxyID* id)
+	{
+		return id->pBody->getType() == BodyType::Static ? m_static : m_dynamic;
 	}
 
 	const ProxyID* HGrid::addBody(Body* pBody)
 	{
-		AABB aabb = pBody->getAABB();
 		ProxyID* id = m_proxyIDAllocator();
+		id->pBody = pBody;
+		updateFilter(id);
 
-		Object object;
-		object.id = id;
+		Grid& grid = getGrid(id);
 
-		object.sphere.c = aabb.c;
-		object.sphere.r = 0;
+		AABB fatAABB = calculateFatAABB(pBody->getAABB(), vec3(0.0f, 0.0f, 0.0f));
 
-		object.sphere.r = length(aabb.e);
+		Sphere sphere;
+		sphere.c = fatAABB.c;
+		sphere.r = length(fatAABB.e);
 
 		for (int i = 0; i < 3; ++i)
 		{
-			if ((object.sphere.c[i] + object.sphere.r) > m_maxExtend[i])
-				m_maxExtend[i] = object.sphere.c[i] + object.sphere.r;
-			else if ((object.sphere.c[i] - object.sphere.r) < m_minExtend[i])
-				m_minExtend[i] = object.sphere.c[i] + object.sphere.r;
+			if ((sphere.c[i] + sphere.r) > grid.maxExtend[i])
+				grid.maxExtend[i] = sphere.c[i] + sphere.r;
+			if ((sphere.c[i] - sphere.r) < grid.minExtend[i])
+				grid.minExtend[i] = sphere.c[i] - sphere.r;
 		}
 
 
-		float size = MIN_CELL_SIZE, diameter = 2.0f * object.sphere.r;
+		float size = MIN_CELL_SIZE, diameter = 2.0f * sphere.r;
 		for (id->level = 0; size* SPHERE_TO_CELL_RATIO < diameter; ++id->level)
 			size *= CELL_TO_CELL_RATIO;
 
 		assert(id->level < MAX_LEVELS);
 
-		int x = (int)(object.sphere.c.x / size);
-		int y = (int)(object.sphere.c.y / size);
-		int z = (int)(object.sphere.c.z / size);
+		int x = (int)floorf(sphere.c.x / size);
+		int y = (int)floorf(sphere.c.y / size);
+		int z = (int)floorf(sphere.c.z / size);
 
-		object.x = x;
-		object.y = y;
-		object.z = z;
-
-		id->bucket = calculateBucketID(x,y,z, id->level);
-		id->idx = m_objectBucket[id->bucket].size();
-		id->pBody = pBody;
+		id->idx = grid.ids.size();
 
+		grid.centers.push_back(sphere.c);
+		grid.radii.push_back(sphere.r);
+		grid.fatAABBs.push_back(fatAABB);
+		for (int i = 0; i < 3; ++i)
+		{
+			grid.aabbMin[i].push_back(0.0f);
+			grid.aabbMax[i].push_back(0.0f);
+		}
+		grid.keys.push_back(calculateCellKey(x, y, z, id->level));
+		grid.next.push_back(-1);
+		grid.prev.push_back(-1);
+		grid.bodies.push_back(pBody);
+		grid.groups.push_back(id->collisionGroup);
+		grid.filters.push_back(id->collisionFilter);
+		grid.ids.push_back(id);
 
-		m_objectBucket[id->bucket].push_back(object);
+		setAABB(grid, id->idx, pBody->getAABB());
+		addToCell(grid, id->idx);
 
-		m_objectsAtLevel[id->level]++;
-		m_occupiedLevelsMask |= (1 << id->level);
+		grid.objectsAtLevel[id->level]++;
+		grid.occupiedLevelsMask |= (1 << id->level);
 
 		return id;
 	}
 	
 	void HGrid::removeBody(const ProxyID* pProxyID)
 	{
-		ProxyID* id = m_objectBucket[pProxyID->bucket][pProxyID->idx].id;
-		removeFromLevel(pProxyID);
-		removeFromBucket(pProxyID);
+		Grid& grid = getGrid(pProxyID);
+
+		ProxyID* id = grid.ids[pProxyID->idx];
+		removeFromLevel(grid, pProxyID->level);
+		removeObject(grid, pProxyID->idx);
 
 		m_proxyIDAllocator.sDelete(id);
 	}
 
-	void HGrid::updateBody(const ProxyID* pProxyID)
+	void HGrid::updateBody(const ProxyID* pProxyID, const vec3& displacement)
 	{
-		AABB aabb = pProxyID->pBody->getAABB();
+		const AABB& aabb = pProxyID->pBody->getAABB();
 
-		Object object = m_objectBucket[pProxyID->bucket][pProxyID->idx];
+		Grid& grid = getGrid(pProxyID);
 
-		object.sphere.c = aabb.c;
-		object.sphere.r = 0;
+		int object = pProxyID->idx;
 
-		object.sphere.r = length(aabb.e);
+		ProxyID* id = grid.ids[object];
+		
+		assert(id == pProxyID);
+
+		updateFilter(id);
+		grid.groups[object] = id->collisionGroup;
+		grid.filters[object] = id->collisionFilter;
+
+		setAABB(grid, object, aabb);
+		if (contains(grid.fatAABBs[object], aabb))
+			return;
+
+		AABB fatAABB = calculateFatAABB(aabb, displacement);
+
+		Sphere sphere;
+		sphere.c = fatAABB.c;
+		sphere.r = length(fatAABB.e);
+
+		grid.fatAABBs[object] = fatAABB;
+		grid.centers[object] = sphere.c;
+		grid.radii[object] = sphere.r;
 
 
 		for (int i = 0; i < 3; ++i)
 		{
-			if ((object.sphere.c[i] + object.sphere.r) > m_maxExtend[i])
-				m_maxExtend[i] = object.sphere.c[i] + object.sphere.r;
-			else if ((object.sphere.c[i] - object.sphere.r) < m_minExtend[i])
-				m_minExtend[i] = object.sphere.c[i] + object.sphere.r;
+			if ((sphere.c[i] + sphere.r) > grid.maxExtend[i])
+				grid.maxExtend[i] = sphere.c[i] + sphere.r;
+			if ((sphere.c[i] - sphere.r) < grid.minExtend[i])
+				grid.minExtend[i] = sphere.c[i] - sphere.r;
 		}
 
 		int level = 0;
-		float size = MIN_CELL_SIZE, diameter = 2.0f * object.sphere.r;
+		float size = MIN_CELL_SIZE, diameter = 2.0f * sphere.r;
 		for (level = 0; size* SPHERE_TO_CELL_RATIO < diameter; ++level)
 			size *= CELL_TO_CELL_RATIO;
 
 		assert(level < MAX_LEVELS);
 
-
-		ProxyID* id = object.id;
-		
-		assert(id == pProxyID);
-
 		if (level != id->level)
 		{
-			removeFromLevel(pProxyID);
+			removeFromLevel(grid, id->level);
 			id->level = level;
 
-			m_objectsAtLevel[id->level]++;
-			m_occupiedLevelsMask |= (1 << id->level);
+			grid.objectsAtLevel[id->level]++;
+			grid.occupiedLevelsMask |= (1 << id->level);
 		}
 
-		int x = (int)(object.sphere.c.x / size);
-		int y = (int)(object.sphere.c.y / size);
-		int z = (int)(object.sphere.c.z / size);
+		int x = (int)floorf(sphere.c.x / size);
+		int y = (int)floorf(sphere.c.y / size);
+		int z = (int)floorf(sphere.c.z / size);
 
-		object.x = x;
-		object.y = y;
-		object.z = z;
-
-		int bucket = calculateBucketID(x,y,z, level);
-		if (bucket != pProxyID->bucket)
+		uint64 key = calculateCellKey(x, y, z, level);
+		if (key != grid.keys[object])
 		{
-			removeFromBucket(pProxyID);
-
-			id->bucket = bucket;
-			id->idx = m_objectBucket[id->bucket].size();
-			m_objectBucket[id->bucket].push_back(object);
+			removeFromCell(grid, object);
+			grid.keys[object] = key;
+			addToCell(grid, object);
 		}
 
 	}
@@ -150,449 +271,742 @@ namespace ong
 
 
 	// returns num Pairs
-	int HGrid::generatePairs(Pair* pairs)
+	int HGrid::generatePairs(std::vector<Pair>* pairs, JobSystem* jobSystem)
 	{
 
-		int numPairs = 0;
+		size_t start = pairs->size();
+
+		int numObjects = (int)m_dynamic.ids.size();
 
-		for (int bucket = 0; bucket < NUM_BUCKETS; ++bucket)
+		if (jobSystem == nullptr || jobSystem->getNumThreads() <= 1 || numObjects <= PAIR_GRAIN_SIZE)
+		{
+			generatePairs(0, numObjects, pairs);
+		}
+		else
 		{
+			// every job fills its own buffer, appending them in job order 
+			// gives the same pairs as the serial search
+			int numJobs = (numObjects + PAIR_GRAIN_SIZE - 1) / PAIR_GRAIN_SIZE;
+			if ((int)m_jobPairs.size() < numJobs)
+				m_jobPairs.resize(numJobs);
 
-			for (uint32 j = 0; j < m_objectBucket[bucket].size(); ++j)
+			jobSystem->parallelFor(numObjects, PAIR_GRAIN_SIZE, [this](int begin, int end, int)
 			{
-				Object &obj = m_objectBucket[bucket][j];
+				std::vector<Pair>& jobPairs = m_jobPairs[begin / PAIR_GRAIN_SIZE];
+				jobPairs.clear();
+				generatePairs(begin, end, &jobPairs);
+			});
 
-				float size = MIN_CELL_SIZE;
-				int startLevel = 0;
+			for (int i = 0; i < numJobs; ++i)
+				pairs->insert(pairs->end(), m_jobPairs[i].begin(), m_jobPairs[i].end());
+		}
 
-				int occupiedLevelsMask = m_occupiedLevelsMask;
-				vec3 pos = obj.sphere.c;
-				float radius = obj.sphere.r;
+		return (int)(pairs->size() - start);
+	}
 
-				for (; size * SPHERE_TO_CELL_RATIO < 2.0f * obj.sphere.r; ++startLevel)
-				{
-					size *= CELL_TO_CELL_RATIO;
-					occupiedLevelsMask >>= 1;
-				}
+	void HGrid::generatePairs(int begin, int end, std::vector<Pair>* pairs)
+	{
+		// only dynamic objects search for pairs,
+		// static ones are found from the dynamic side
+		for (int i = begin; i < end; ++i)
+		{
+			generatePairs(i, m_dynamic, pairs);
 
-				m_tick++;
+			// static and sleeping bodies do not collide with each other
+			if (m_dynamic.bodies[i]->isActive())
+				generatePairs(i, m_static, pairs);
+		}
+	}
 
-				for (int level = startLevel; level < MAX_LEVELS;
-					size *= CELL_TO_CELL_RATIO, occupiedLevelsMask >>= 1, ++level)
-				{
-					if (occupiedLevelsMask == 0)
-						break;
 
-					if ((occupiedLevelsMask & 1) == 0) 
-						continue;
+	// tests up to four objects against the bounds, returns a bit per overlapping object
+	static inline int overlap4(const std::vector<float>* aabbMin, const std::vector<float>* aabbMax,
+		const int* objects, int count, const __m128* min, const __m128* max)
+	{
+		// unused lanes repeat the first object and are masked
+		int o1 = count > 1 ? objects[1] : objects[0];
+		int o2 = count > 2 ? objects[2] : objects[0];
+		int o3 = count > 3 ? objects[3] : objects[0];
 
-					float ooSize = 1.0f / size;
-					
-					int x1, y1, z1, x2, y2, z2;
+		__m128 result = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int i = 0; i < 3; ++i)
+		{
+			const float* pMin = aabbMin[i].data();
+			const float* pMax = aabbMax[i].data();
 
-					float delta = radius + size * SPHERE_TO_CELL_RATIO + FLT_EPSILON * size;
-					x1 = (int)floorf((pos.x - delta) * ooSize);
-					y1 = (int)floorf((pos.y - delta) * ooSize);
-					z1 = (int)floorf((pos.z - delta) * ooSize);
+			__m128 otherMin = _mm_setr_ps(pMin[objects[0]], pMin[o1], pMin[o2], pMin[o3]);
+			__m128 otherMax = _mm_setr_ps(pMax[objects[0]], pMax[o1], pMax[o2], pMax[o3]);
 
-					x2 = (int)ceilf((pos.x + delta) * ooSize);
-					y2 = (int)ceilf((pos.y + delta) * ooSize);
-					z2 = (int)ceilf((pos.z + delta) * ooSize);
+			result = _mm_and_ps(result, _mm_cmple_ps(min[i], otherMax));
+			result = _mm_and_ps(result, _mm_cmple_ps(otherMin, max[i]));
+		}
 
+		return _mm_movemask_ps(result) & ((1 << count) - 1);
+	}
 
+	void HGrid::generatePairs(int object, const Grid& grid, std::vector<Pair>* pairs)
+	{
+		bool sameGrid = &grid == &m_dynamic;
 
-					for (int x = x1; x <= x2; ++x)
-					{
-						for (int y = y1; y <= y2; ++y)
-						{
-							for (int z = z1; z <= z2; ++z)
-							{
-								int bucket2 = calculateBucketID(x, y, z, level);
+		float size = MIN_CELL_SIZE;
+		int startLevel = 0;
 
-								if (m_timeStamp[bucket2] == m_tick)
-									continue;
-								m_timeStamp[bucket2] = m_tick;
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
+		vec3 pos = m_dynamic.centers[object];
+		float radius = m_dynamic.radii[object];
+		int objectLevel = (int)(m_dynamic.keys[object] & LEVEL_MASK);
 
-								int startIndex = bucket == bucket2 ? j + 1 : 0;
+		Body* a = m_dynamic.bodies[object];
+		uint32 group = m_dynamic.groups[object];
+		uint32 filter = m_dynamic.filters[object];
 
-								for (uint32 k = startIndex; k < m_objectBucket[bucket2].size(); ++k)
-								{
-									Object& obj2 = m_objectBucket[bucket2][k];
+		__m128 min[3], max[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			min[i] = _mm_set1_ps(m_dynamic.aabbMin[i][object]);
+			max[i] = _mm_set1_ps(m_dynamic.aabbMax[i][object]);
+		}
 
-									//skip if objects are the same
-									//or if an object of an higher level is checked against an object with an lower level
-									//or if an bucket with an higher index is checked against a bucket with a lower index if they are on the same level
-									//or if buckets are the same but index of object a is higher than index of object b
-									if (obj.id->level > obj2.id->level || (obj.id->level == obj2.id->level && bucket > bucket2))
-										continue;
+		// candidates are tested in groups of four
+		int candidates[4];
+		int numCandidates = 0;
 
+		auto testCandidates = [&]()
+		{
+			int mask = overlap4(grid.aabbMin, grid.aabbMax, candidates, numCandidates, min, max);
 
-									Body* a = obj.id->pBody;
-									Body* b = obj2.id->pBody;
+			for (int k = 0; k < numCandidates; ++k)
+			{
+				if ((mask & (1 << k)) == 0)
+					continue;
 
-									if (overlap(&a->getAABB(), &b->getAABB()))
-									{
-										if (a->getType() == BodyType::Static && b->getType() == BodyType::Static)
-											continue;
+				Body* b = grid.bodies[candidates[k]];
+
+				// sleeping bodies do not collide with each other
+				if (!a->isActive() && !b->isActive())
+					continue;
 
-										pairs[numPairs++] = Pair{ a, b };
+				pairs->push_back(Pair{ a, b });
+			}
 
-									}
+			numCandidates = 0;
+		};
 
-								}
+		// objects of lower levels find this one, static objects do not search
+		if (sameGrid)
+		{
+			for (; startLevel < objectLevel; ++startLevel)
+			{
+				size *= CELL_TO_CELL_RATIO;
+				occupiedLevelsMask >>= 1;
+			}
+		}
 
+		for (int level = startLevel; level < MAX_LEVELS;
+			size *= CELL_TO_CELL_RATIO, occupiedLevelsMask >>= 1, ++level)
+		{
+			if (occupiedLevelsMask == 0)
+				break;
 
-							}
+			if ((occupiedLevelsMask & 1) == 0) 
+				continue;
+
+			float ooSize = 1.0f / size;
+			
+			int x1, y1, z1, x2, y2, z2;
+
+			float delta = radius + size * SPHERE_TO_CELL_RATIO + FLT_EPSILON * size;
+			x1 = (int)floorf((pos.x - delta) * ooSize);
+			y1 = (int)floorf((pos.y - delta) * ooSize);
+			z1 = (int)floorf((pos.z - delta) * ooSize);
+
+			x2 = (int)ceilf((pos.x + delta) * ooSize);
+			y2 = (int)ceilf((pos.y + delta) * ooSize);
+			z2 = (int)ceilf((pos.z + delta) * ooSize);
+
+			// objects of the same level are paired from the lower index
+			bool sameLevel = sameGrid && level == objectLevel;
 
+			for (int x = x1; x <= x2; ++x)
+			{
+				for (int y = y1; y <= y2; ++y)
+				{
+					for (int z = z1; z <= z2; ++z)
+					{
+						int cell = findCell(grid, calculateCellKey(x, y, z, level));
+						if (cell == -1)
+							continue;
+
+						for (int j = grid.cells[cell].first; j != -1; j = grid.next[j])
+						{
+							if (sameLevel && j <= object)
+								continue;
+
+							// bodies whose colliders filter each other never get a pair
+							if ((group & grid.filters[j]) != 0 || (grid.groups[j] & filter) != 0)
+								continue;
+
+							candidates[numCandidates++] = j;
+							if (numCandidates == 4)
+								testCandidates();
 						}
-					}
 
+						if (numCandidates > 0)
+							testCandidates();
+					}
 				}
 			}
-		}
-
 
-		return numPairs;
+		}
 	}
 
 
-	void HGrid::removeFromBucket(const ProxyID* id)
+	void HGrid::addToCell(Grid& grid, int object)
 	{
-		if (m_objectBucket[id->bucket].size() > 1)
-		{
-			if (&m_objectBucket[id->bucket][id->idx] != &m_objectBucket[id->bucket].back())
-			{
-				m_objectBucket[id->bucket][id->idx] = m_objectBucket[id->bucket].back();
-				ProxyID* pOtherProxy = m_objectBucket[id->bucket][id->idx].id;
-				pOtherProxy->idx = id->idx;
-			}
-			m_objectBucket[id->bucket].pop_back();
-		}
-		else
+		uint64 key = grid.keys[object];
+
+		int cell = findCell(grid, key);
+		if (cell != -1)
 		{
-			m_objectBucket[id->bucket].clear();
+			int first = grid.cells[cell].first;
+
+			grid.next[object] = first;
+			grid.prev[object] = -1;
+			grid.prev[first] = object;
+			grid.cells[cell].first = object;
+			return;
 		}
+
+		int mask = (int)grid.cells.size() - 1;
+		int slot = hashCellKey(key) & mask;
+		while (grid.cells[slot].key != EMPTY_CELL)
+			slot = (slot + 1) & mask;
+
+		grid.cells[slot].key = key;
+		grid.cells[slot].first = object;
+		grid.next[object] = -1;
+		grid.prev[object] = -1;
+
+		if (++grid.numUsedCells > m_maxLoadFactor * grid.cells.size())
+			rehash(grid, 2 * (int)grid.cells.size());
 	}
 
-	void HGrid::removeFromLevel(const ProxyID* id)
+	void HGrid::removeFromCell(Grid& grid, int object)
 	{
-		if (--m_objectsAtLevel[id->level] == 0)
-			m_occupiedLevelsMask &= ~(1 << id->level);
-	}
+		int prev = grid.prev[object];
+		int next = grid.next[object];
 
+		if (next != -1)
+			grid.prev[next] = prev;
 
+		if (prev != -1)
+		{
+			grid.next[prev] = next;
+			return;
+		}
 
+		int cell = findCell(grid, grid.keys[object]);
+		assert(cell != -1);
 
+		if (next != -1)
+			grid.cells[cell].first = next;
+		else
+			eraseCell(grid, cell);
+	}
 
-	bool HGrid::queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax)
+	void HGrid::eraseCell(Grid& grid, int slot)
 	{
+		int mask = (int)grid.cells.size() - 1;
 
-		m_tick++;
+		// shift following cells back so probing never stops early
+		for (int i = (slot + 1) & mask; grid.cells[i].key != EMPTY_CELL; i = (i + 1) & mask)
+		{
+			int home = hashCellKey(grid.cells[i].key) & mask;
 
+			// the cell may move if its home is not in (slot, i]
+			if (((i - home) & mask) >= ((i - slot) & mask))
+			{
+				grid.cells[slot] = grid.cells[i];
+				slot = i;
+			}
+		}
 
-		struct Cell
-		{
-			int i, j, k;
-			vec3 t;
-			vec3 d;
-		};
+		grid.cells[slot].key = EMPTY_CELL;
+		grid.numUsedCells--;
+	}
 
+	void HGrid::rehash(Grid& grid, int numCells)
+	{
+		std::vector<Cell> cells(numCells);
+		for (Cell& cell : cells)
+			cell.key = EMPTY_CELL;
 
-		Cell cells[MAX_LEVELS];
+		grid.cells.swap(cells);
 
-		int iEnd;
-		int jEnd;
-		int kEnd;
+		int mask = numCells - 1;
+		for (const Cell& cell : cells)
+		{
+			if (cell.key == EMPTY_CELL)
+				continue;
 
-		int di = ((dir.x > 0) ? 1 : (dir.x < 0) ? -1 : 0);
-		int dj = ((dir.y > 0) ? 1 : (dir.y < 0) ? -1 : 0);
-		int dk = ((dir.z > 0) ? 1 : (dir.z < 0) ? -1 : 0);
+			int slot = hashCellKey(cell.key) & mask;
+			while (grid.cells[slot].key != EMPTY_CELL)
+				slot = (slot + 1) & mask;
+
+			grid.cells[slot] = cell;
+		}
+	}
 
 
-		float maxSize = MIN_CELL_SIZE;
-		int occupiedLevelsMask = m_occupiedLevelsMask;
-		int maxLevel = 0;
-		for (maxLevel = 0; maxLevel < MAX_LEVELS; ++maxLevel, occupiedLevelsMask >>= 1)
+	void HGrid::setAABB(Grid& grid, int object, const AABB& aabb)
+	{
+		for (int i = 0; i < 3; ++i)
 		{
-			if (occupiedLevelsMask == 0)
-				break;
-			maxSize *= CELL_TO_CELL_RATIO;
+			grid.aabbMin[i][object] = aabb.c[i] - aabb.e[i];
+			grid.aabbMax[i][object] = aabb.c[i] + aabb.e[i];
 		}
+	}
 
-
-		vec3 end = origin + maxSize * dir;
-		
-		float size = MIN_CELL_SIZE;
-		for (int level = 0; level < maxLevel; ++level)
+	AABB HGrid::getAABB(const Grid& grid, int object)
+	{
+		AABB aabb;
+		for (int i = 0; i < 3; ++i)
 		{
+			aabb.c[i] = 0.5f * (grid.aabbMin[i][object] + grid.aabbMax[i][object]);
+			aabb.e[i] = 0.5f * (grid.aabbMax[i][object] - grid.aabbMin[i][object]);
+		}
+		return aabb;
+	}
 
-			cells[level].i = (int)floorf(origin.x / size);
-			cells[level].j = (int)floorf(origin.y / size);
-			cells[level].k = (int)floorf(origin.z / size);
 
-			float minx = size * floorf(origin.x / size);
-			float miny = size * floorf(origin.y / size);
-			float minz = size * floorf(origin.z / size);
+	void HGrid::removeObject(Grid& grid, int object)
+	{
+		removeFromCell(grid, object);
 
-			float maxx = minx + size;
-			float maxy = miny + size;
-			float maxz = minz + size;
-						 
-			cells[level].t.x = ((dir.x < 0) ? (origin.x - minx) : (maxx - origin.x)) / abs(dir.x);
-			cells[level].t.y = ((dir.y < 0) ? (origin.y - miny) : (maxy - origin.y)) / abs(dir.y);
-			cells[level].t.z = ((dir.z < 0) ? (origin.z - miny) : (maxy - origin.z)) / abs(dir.z);
+		// move the last object into the gap
+		int last = (int)grid.ids.size() - 1;
+		if (object != last)
+		{
+			if (grid.prev[last] != -1)
+				grid.next[grid.prev[last]] = object;
+			else
+				grid.cells[findCell(grid, grid.keys[last])].first = object;
 
-			cells[level].d.x = size / abs(dir.x);
-			cells[level].d.y = size / abs(dir.y);
-			cells[level].d.z = size / abs(dir.z);
+			if (grid.next[last] != -1)
+				grid.prev[grid.next[last]] = object;
 
-			size *= CELL_TO_CELL_RATIO;
+			grid.centers[object] = grid.centers[last];
+			grid.radii[object] = grid.radii[last];
+			grid.fatAABBs[object] = grid.fatAABBs[last];
+			for (int i = 0; i < 3; ++i)
+			{
+				grid.aabbMin[i][object] = grid.aabbMin[i][last];
+				grid.aabbMax[i][object] = grid.aabbMax[i][last];
+			}
+			grid.keys[object] = grid.keys[last];
+			grid.next[object] = grid.next[last];
+			grid.prev[object] = grid.prev[last];
+			grid.bodies[object] = grid.bodies[last];
+			grid.groups[object] = grid.groups[last];
+			grid.filters[object] = grid.filters[last];
+			grid.ids[object] = grid.ids[last];
+
+			grid.ids[object]->idx = object;
 		}
 
-		cells[maxLevel].i = (int)floorf(origin.x / maxSize);
-		cells[maxLevel].j = (int)floorf(origin.y / maxSize);
-		cells[maxLevel].k = (int)floorf(origin.z / maxSize);
+		grid.centers.pop_back();
+		grid.radii.pop_back();
+		grid.fatAABBs.pop_back();
+		for (int i = 0; i < 3; ++i)
+		{
+			grid.aabbMin[i].pop_back();
+			grid.aabbMax[i].pop_back();
+		}
+		grid.keys.pop_back();
+		grid.next.pop_back();
+		grid.prev.pop_back();
+		grid.bodies.pop_back();
+		grid.groups.pop_back();
+		grid.filters.pop_back();
+		grid.ids.pop_back();
+	}
 
-		iEnd = (int)floorf((di >= 0 ? m_maxExtend.x : m_minExtend.x) / maxSize);
-		jEnd = (int)floorf((dj >= 0 ? m_maxExtend.y : m_minExtend.y) / maxSize);
-		kEnd = (int)floorf((dk >= 0 ? m_maxExtend.z : m_minExtend.z) / maxSize);
+	void HGrid::removeFromLevel(Grid& grid, int level)
+	{
+		if (--grid.objectsAtLevel[level] == 0)
+			grid.occupiedLevelsMask &= ~(1 << level);
+	}
 
 
-		RayQueryResult minResult;
-		minResult.collider = 0;
-		minResult.t = FLT_MAX;
+	void HGrid::getStats(HGridStats* stats) const
+	{
+		stats->numCells = 0;
+		stats->numUsedCells = 0;
+		stats->numObjects = 0;
+		stats->maxObjectsPerCell = 0;
+		stats->maxProbeLength = 0;
+		stats->loadFactor = 0.0f;
+
+		const Grid* grids[2] = { &m_dynamic, &m_static };
+		for (int i = 0; i < 2; ++i)
+		{
+			const Grid& grid = *grids[i];
+			int mask = (int)grid.cells.size() - 1;
 
+			stats->numCells += grid.cells.size();
+			stats->numUsedCells += grid.numUsedCells;
+			stats->numObjects += grid.ids.size();
 
-		//check origin for neighbouring cells
-		size = MIN_CELL_SIZE;
-		for (int level = 0; level < maxLevel; ++level)
-		{
-			if (m_objectsAtLevel[level] == 0)
-				continue;
+			for (int slot = 0; slot <= mask; ++slot)
+			{
+				const Cell& cell = grid.cells[slot];
+				if (cell.key == EMPTY_CELL)
+					continue;
 
+				int numObjects = 0;
+				for (int j = cell.first; j != -1; j = grid.next[j])
+					numObjects++;
 
-			int x0 = cells[level].i, x1 = cells[level].i;
-			int y0 = cells[level].j, y1 = cells[level].j;
-			int z0 = cells[level].k, z1 = cells[level].k;
+				int probeLength = ((slot - (int)(hashCellKey(cell.key) & mask)) & mask) + 1;
 
+				stats->maxObjectsPerCell = ong_MAX(stats->maxObjectsPerCell, numObjects);
+				stats->maxProbeLength = ong_MAX(stats->maxProbeLength, probeLength);
+			}
 
-			if ((int)floorf(origin.x / size - SPHERE_TO_CELL_RATIO * size) != cells[level].i)
-				--x0;
-			if ((int)floorf(origin.y / size + SPHERE_TO_CELL_RATIO * size) != cells[level].i)
-				++x1;
+			stats->loadFactor = ong_MAX(stats->loadFactor, (float)grid.numUsedCells / grid.cells.size());
+		}
+	}
 
-			if ((int)floorf(origin.y / size - SPHERE_TO_CELL_RATIO * size) != cells[level].j)
-				--y0;
-			if ((int)floorf(origin.y / size + SPHERE_TO_CELL_RATIO * size) != cells[level].j)
-				++y1;
 
-			if ((int)floorf(origin.z / size - SPHERE_TO_CELL_RATIO * size) != cells[level].k)
-				--z0;
-			if ((int)floorf(origin.y / size + SPHERE_TO_CELL_RATIO * size) != cells[level].k)
-				++z1;
 
-			for (int x = x0; x <= x1; ++x)
-			{
-				for (int y = y0; y <= y1; ++y)
-				{
-					for (int z = z0; z <= z1; ++z)
-					{
-						int bucket = calculateBucketID(x, y, z, level);
-						if (m_timeStamp[bucket] == m_tick)
-							continue;
-						m_timeStamp[bucket] = m_tick;
 
-						for (Object& obj : m_objectBucket[bucket])
-						{
-							float tmin;
-							vec3 p;
-							if (intersectRayAABB(origin, dir, obj.id->pBody->getAABB(), tmin, p) && tmin < tmax)
-							{
-								RayQueryResult result = { 0 };
-								if (obj.id->pBody->queryRay(origin, dir, &result, tmax))
-								{
-									if (result.t < minResult.t)
-										minResult = result;
-								}
-							}
-						}
 
+	bool HGrid::queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax)
+	{
+		Ray ray = { origin, dir, tmax };
 
-					}
-				}
-			}
-								
+		RayQueryResult result;
+		if (queryRays(&ray, 1, &result) == 0)
+			return false;
 
+		*hit = result;
+		return true;
+	}
 
-			size *= CELL_TO_CELL_RATIO;
+	int HGrid::queryRays(const Ray* rays, int n, RayQueryResult* hits, JobSystem* jobSystem)
+	{
+		int numThreads = 1;
+		if (jobSystem != nullptr && n > RAY_GRAIN_SIZE)
+			numThreads = jobSystem->getNumThreads();
+
+		prepareRayContexts(numThreads);
+
+		if (numThreads <= 1)
+		{
+			queryRays(0, n, rays, hits, m_rayContexts[0]);
+		}
+		else
+		{
+			// jobs start at multiples of the packet size, 
+			// so the packets do not depend on the number of threads
+			jobSystem->parallelFor(n, RAY_GRAIN_SIZE, [=](int begin, int end, int thread)
+			{
+				queryRays(begin, end, rays, hits, m_rayContexts[thread]);
+			});
 		}
 
-		int bucket;
-		//todo FIX !!!
-		static int MAX_ITERS = 100;
-		for (int iter = 0 ; iter < MAX_ITERS;++ iter)
+		int numHits = 0;
+		for (int i = 0; i < n; ++i)
 		{
-			float ooSize = 1.0f / maxSize;
+			if (hits[i].collider != nullptr)
+				numHits++;
+		}
 
-			for (int l = maxLevel - 1; l >= 0; --l)
-			{
-				ooSize *= CELL_TO_CELL_RATIO;
+		return numHits;
+	}
 
-				if (m_objectsAtLevel[l] == 0)
-					continue;
+	bool HGrid::queryOcclusion(const vec3& origin, const vec3& dir, float tmax)
+	{
+		prepareRayContexts(1);
 
+		// static geometry blocks most rays
+		return queryOcclusion(m_static, origin, dir, tmax, m_rayContexts[0]) ||
+			queryOcclusion(m_dynamic, origin, dir, tmax, m_rayContexts[0]);
+	}
 
-				for (;;)
-				{
-					int x0 = cells[l].i, x1 = cells[l].i;
-					int y0 = cells[l].k, y1 = cells[l].j;
-					int z0 = cells[l].j, z1 = cells[l].k;
+	void HGrid::prepareRayContexts(int numThreads)
+	{
+		// every thread stamps the objects it already tested
+		int numObjects = (int)ong_MAX(m_dynamic.ids.size(), m_static.ids.size());
+		if ((int)m_rayContexts.size() < numThreads)
+			m_rayContexts.resize(numThreads);
+		for (int i = 0; i < numThreads; ++i)
+		{
+			if ((int)m_rayContexts[i].stamps.size() < numObjects)
+				m_rayContexts[i].stamps.resize(numObjects, 0);
+		}
+	}
 
-					bool quit = false;
+	void HGrid::queryRays(int begin, int end, const Ray* rays, RayQueryResult* hits, RayQueryContext& context) const
+	{
+		for (int i = begin; i < end; i += RAY_PACKET_SIZE)
+		{
+			int count = ong_MIN(RAY_PACKET_SIZE, end - i);
 
-					if (cells[l].t.x <= cells[l].t.y && cells[l].t.x <= cells[l].t.z)
-					{
+			for (int k = 0; k < count; ++k)
+			{
+				hits[i + k].collider = nullptr;
+				hits[i + k].t = rays[i + k].tmax;
+			}
 
-						vec3 p = origin + cells[l].t.x * dir;
+			// static hits have to be closer than the dynamic ones
+			queryRays(m_dynamic, rays + i, count, hits + i, context);
+			queryRays(m_static, rays + i, count, hits + i, context);
+		}
+	}
 
-						if ((int)floorf(p.y - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].j)
-							--y0;
-						else if ((int)floorf(p.y + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].j)
-							++y1;
+	bool HGrid::queryCollider(const Collider* collider)
+	{
+		return queryCollider(m_dynamic, collider) || queryCollider(m_static, collider);
+	}
 
-						if ((int)floorf(p.z - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].k)
-							--z0;
-						else if ((int)floorf(p.z + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].k)
-							++z1;
-						
-						cells[l].t.x += cells[l].d.x;
-						cells[l].i += di;
+	bool HGrid::queryCollider(Collider* collider, ColliderQueryCallBack callback)
+	{
+		bool stop = false;
+		bool hitDynamic = queryCollider(m_dynamic, collider, callback, stop);
+		if (stop)
+			return true;
+		return queryCollider(m_static, collider, callback, stop) || hitDynamic;
+	}
 
-						if ((int)floorf(cells[l].i/(maxSize*ooSize)) != cells[maxLevel].i)
-							quit = true;
-					}
-					else if (cells[l].t.y <= cells[l].t.z)
-					{
+	bool HGrid::queryShape(ShapePtr shape, const Transform& transform)
+	{
+		return queryShape(m_dynamic, shape, transform) || queryShape(m_static, shape, transform);
+	}
+
+	bool HGrid::queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData)
+	{
+		bool stop = false;
+		bool hitDynamic = queryShape(m_dynamic, shape, transform, callback, userData, stop);
+		if (stop)
+			return true;
+		return queryShape(m_static, shape, transform, callback, userData, stop) || hitDynamic;
+	}
 
-						vec3 p = origin + cells[l].t.y * dir;
 
-						if ((int)floorf(p.x - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].i)
-							--x0;
-						else if ((int)floorf(p.x + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].i)
-							++x1;
+	// clips the ray against the box, t0 and t1 are the entry and exit
+	static bool clipRay(const vec3& origin, const vec3& dir, const vec3& min, const vec3& max, float& t0, float& t1)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (dir[i] == 0.0f)
+			{
+				if (origin[i] < min[i] || origin[i] > max[i])
+					return false;
+				continue;
+			}
 
-						if ((int)floorf(p.z - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].k)
-							--z0;
-						else if ((int)floorf(p.z + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].k)
-							++z1;
+			float ooDir = 1.0f / dir[i];
+			float tNear = (min[i] - origin[i]) * ooDir;
+			float tFar = (max[i] - origin[i]) * ooDir;
+			if (tNear > tFar)
+				std::swap(tNear, tFar);
 
+			t0 = ong_MAX(t0, tNear);
+			t1 = ong_MIN(t1, tFar);
 
-						cells[l].t.y += cells[l].d.y;
-						cells[l].j += dj;
+			if (t0 > t1)
+				return false;
+		}
 
-						if ((int)floorf(cells[l].j / (maxSize*ooSize)) != cells[maxLevel].j)
-							quit = true;
-					}
-					else
-					{
+		return true;
+	}
 
-						vec3 p = origin + cells[l].t.z * dir;
+	template<typename F>
+	bool HGrid::walkRay(const Grid& grid, const vec3& origin, const vec3& dir, const float& tmax, const F& visit) const
+	{
+		float t0 = 0.0f, t1 = tmax;
+		if (!clipRay(origin, dir, grid.minExtend, grid.maxExtend, t0, t1))
+			return true;
 
-						if ((int)floorf(p.x - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].i)
-							--x0;
-						else if ((int)floorf(p.x + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].i)
-							++x1;
+		// walk the cells of every occupied level along the ray,
+		// objects reach at most into the neighbouring cells
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
+		float size = MIN_CELL_SIZE;
+		for (int level = 0; level < MAX_LEVELS;
+			size *= CELL_TO_CELL_RATIO, occupiedLevelsMask >>= 1, ++level)
+		{
+			if (occupiedLevelsMask == 0)
+				break;
 
-						if ((int)floorf(p.y - SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].j)
-							--y0;
-						else if ((int)floorf(p.y + SPHERE_TO_CELL_RATIO * 1.0f / ooSize) != cells[l].j)
-							++y1;
+			if ((occupiedLevelsMask & 1) == 0)
+				continue;
 
+			float ooSize = 1.0f / size;
+			vec3 p = origin + t0 * dir;
 
-						cells[l].t.z += cells[l].d.z;
-						cells[l].k += dk;
+			int cell[3], step[3];
+			float tNext[3], tDelta[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				cell[i] = (int)floorf(p[i] * ooSize);
 
-						if ((int)floorf(cells[l].k / (maxSize*ooSize)) != cells[maxLevel].k)
-							quit = true;
-					}
+				if (dir[i] > 0.0f)
+				{
+					step[i] = 1;
+					tNext[i] = t0 + ((cell[i] + 1) * size - p[i]) / dir[i];
+					tDelta[i] = size / dir[i];
+				}
+				else if (dir[i] < 0.0f)
+				{
+					step[i] = -1;
+					tNext[i] = t0 + (cell[i] * size - p[i]) / dir[i];
+					tDelta[i] = -size / dir[i];
+				}
+				else
+				{
+					step[i] = 0;
+					tNext[i] = FLT_MAX;
+					tDelta[i] = FLT_MAX;
+				}
+			}
 
+			// hits behind the current cell were found in an earlier one.
+			// after a step only the new layer of neighbours has to be looked up
+			int axis = -1;
+			for (float t = t0; t <= t1 && t <= tmax;)
+			{
+				int lo[3], hi[3];
+				for (int i = 0; i < 3; ++i)
+				{
+					lo[i] = cell[i] - 1;
+					hi[i] = cell[i] + 1;
+				}
+				if (axis != -1)
+					lo[axis] = hi[axis] = cell[axis] + step[axis];
 
-					for (int x = x0; x <= x1; ++x)
+				for (int x = lo[0]; x <= hi[0]; ++x)
+				{
+					for (int y = lo[1]; y <= hi[1]; ++y)
 					{
-						for (int y = y0; y <= y1; ++y)
+						for (int z = lo[2]; z <= hi[2]; ++z)
 						{
-							for (int z = z0; z <= z1; ++z)
-							{
-								bucket = calculateBucketID(x, y, z, l);
-								if (m_timeStamp[bucket] == m_tick)
-									continue;
-								m_timeStamp[bucket] = m_tick;
-
-								for (Object& obj : m_objectBucket[bucket])
-								{
-									float tmin;
-									vec3 p;
-									if (intersectRayAABB(origin, dir, obj.id->pBody->getAABB(), tmin, p) && tmin < tmax)
-									{
-										RayQueryResult result = { 0 };
-										if (obj.id->pBody->queryRay(origin, dir, &result, tmax))
-										{
-											if (result.t < minResult.t)
-												minResult = result;
-										}
-									}
-								}
-
+							int c = findCell(grid, calculateCellKey(x, y, z, level));
+							if (c == -1)
+								continue;
 
+							for (int i = grid.cells[c].first; i != -1; i = grid.next[i])
+							{
+								if (!visit(i))
+									return false;
 							}
 						}
 					}
-						
-					if (quit)
-						break;
 				}
-			}
 
-			if (minResult.collider != 0)
-			{
-				*hit = minResult;
-				return true;
+				axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+				t = tNext[axis];
+				cell[axis] += step[axis];
+				tNext[axis] += tDelta[axis];
 			}
+		}
 
-			if (cells[maxLevel].t.x <= cells[maxLevel].t.y && cells[maxLevel].t.x <= cells[maxLevel].t.z)
-			{
-				if (cells[maxLevel].i == iEnd)
-					return false;
-				cells[maxLevel].t.x += cells[maxLevel].d.x;
-				cells[maxLevel].i += di;
+		return true;
+	}
 
-			}
-			else if (cells[maxLevel].t.y <= cells[maxLevel].t.z)
-			{
-				if (cells[maxLevel].j == jEnd)
-					return false;
-				cells[maxLevel].t.y += cells[maxLevel].d.y;
-				cells[maxLevel].j += dj;
+	// tests the bounds of the object against the packet, returns a bit per hit ray
+	static inline int intersectRays4(const RayPacket& packet, __m128 tmax,
+		const std::vector<float>* aabbMin, const std::vector<float>* aabbMax, int object)
+	{
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = tmax;
+		for (int i = 0; i < 3; ++i)
+		{
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMin[i][object]), packet.origin[i]), packet.ooDir[i]);
+			__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabbMax[i][object]), packet.origin[i]), packet.ooDir[i]);
 
-			}
-			else
+			tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+			tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+		}
+
+		return _mm_movemask_ps(_mm_cmple_ps(tNear, tFar));
+	}
+
+	void HGrid::queryRays(const Grid& grid, const Ray* rays, int count, RayQueryResult* hits, RayQueryContext& context) const
+	{
+		if (grid.ids.empty())
+			return;
+
+		// unused lanes repeat the first ray and are masked
+		vec3 origins[RAY_PACKET_SIZE], dirs[RAY_PACKET_SIZE];
+		for (int k = 0; k < count; ++k)
+		{
+			origins[k] = rays[k].origin;
+			dirs[k] = rays[k].dir;
+		}
+
+		RayPacket packet;
+		setRayPacket(&packet, origins, dirs, count);
+
+		int laneMask = (1 << count) - 1;
+
+		float tmax[RAY_PACKET_SIZE] = { 0.0f };
+		for (int k = 0; k < count; ++k)
+			tmax[k] = hits[k].t;
+
+		// an object found by one ray is tested against the whole packet at once
+		uint32 tick = ++context.tick;
+		uint32* stamps = context.stamps.data();
+
+		for (int k = 0; k < count; ++k)
+		{
+			walkRay(grid, rays[k].origin, rays[k].dir, tmax[k], [&](int i) -> bool
 			{
-				if (cells[maxLevel].k == kEnd) 
-					return false;
-				cells[maxLevel].t.z += cells[maxLevel].d.z;
-				cells[maxLevel].k += dk;
+				if (stamps[i] == tick)
+					return true;
+				stamps[i] = tick;
 
-			}
+				int mask = intersectRays4(packet, _mm_loadu_ps(tmax),
+					grid.aabbMin, grid.aabbMax, i) & laneMask;
+
+				// the lanes that hit the bounds walk the tree of the body together
+				if (mask != 0)
+					grid.bodies[i]->queryRays(rays, count, mask, hits, tmax);
 
+				return true;
+			});
 		}
 	}
 
-	bool HGrid::queryCollider(const Collider* collider)
+	bool HGrid::queryOcclusion(const Grid& grid, const vec3& origin, const vec3& dir, float tmax, RayQueryContext& context) const
 	{
+		if (grid.ids.empty())
+			return false;
+
+		uint32 tick = ++context.tick;
+		uint32* stamps = context.stamps.data();
 
-		m_tick++;
+		// the walk stops at the first hit
+		return !walkRay(grid, origin, dir, tmax, [&](int i) -> bool
+		{
+			if (stamps[i] == tick)
+				return true;
+			stamps[i] = tick;
+
+			float tmin;
+			vec3 p;
+			if (!intersectRayAABB(origin, dir, getAABB(grid, i), tmin, p) || tmin > tmax)
+				return true;
+
+			return !grid.bodies[i]->queryOcclusion(origin, dir, tmax);
+		});
+	}
 
-		int occupiedLevelsMask = m_occupiedLevelsMask;
+	bool HGrid::queryCollider(const Grid& grid, const Collider* collider)
+	{
+
+
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
 		
 		vec3 pos = collider->getAABB().c;
 		float radius = length(collider->getAABB().e);
@@ -630,14 +1044,13 @@ namespace ong
 				{
 					for (int z = z1; z <= z2; ++z)
 					{
-						int bucket = calculateBucketID(x, y, z, level);
-						if (m_timeStamp[bucket] == m_tick)
+						int cell = findCell(grid, calculateCellKey(x, y, z, level));
+						if (cell == -1)
 							continue;
-						m_timeStamp[bucket] = m_tick;
 
-						for (uint32 i = 0; i < m_objectBucket[bucket].size(); ++i)
+						for (int i = grid.cells[cell].first; i != -1; i = grid.next[i])
 						{
-							Body* body = m_objectBucket[bucket][i].id->pBody;
+							Body* body = grid.bodies[i];
 
 							if (collider->getBody() == body)
 								continue;
@@ -653,12 +1066,11 @@ namespace ong
 	}
 
 
-	bool HGrid::queryCollider(Collider* collider, ColliderQueryCallBack callback)
+	bool HGrid::queryCollider(const Grid& grid, Collider* collider, ColliderQueryCallBack callback, bool& stop)
 	{
 
-		m_tick++;
 
-		int occupiedLevelsMask = m_occupiedLevelsMask;
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
 
 		vec3 pos = collider->getAABB().c;
 		float radius = length(collider->getAABB().e);
@@ -698,19 +1110,21 @@ namespace ong
 				{
 					for (int z = z1; z <= z2; ++z)
 					{
-						int bucket = calculateBucketID(x, y, z, level);
-						if (m_timeStamp[bucket] == m_tick)
+						int cell = findCell(grid, calculateCellKey(x, y, z, level));
+						if (cell == -1)
 							continue;
-						m_timeStamp[bucket] = m_tick;
 
-						for (uint32 i = 0; i < m_objectBucket[bucket].size(); ++i)
+						for (int i = grid.cells[cell].first; i != -1; i = grid.next[i])
 						{
-							Body* body = m_objectBucket[bucket][i].id->pBody;
+							Body* body = grid.bodies[i];
 
 							if (collider->getBody() == body)
 								continue;
 							if (!body->queryCollider(collider, callback))
+							{
+								stop = true;
 								return true;
+							}
 							else hit = true;
 						}
 
@@ -721,12 +1135,11 @@ namespace ong
 		return hit;
 	}
 
-	bool HGrid::queryShape(ShapePtr shape, const Transform& transform)
+	bool HGrid::queryShape(const Grid& grid, ShapePtr shape, const Transform& transform)
 	{
 
-		m_tick++;
 
-		int occupiedLevelsMask = m_occupiedLevelsMask;
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
 
 		AABB aabb = calculateAABB(shape, transform);
 
@@ -764,14 +1177,13 @@ namespace ong
 				{
 					for (int z = z1; z <= z2; ++z)
 					{
-						int bucket = calculateBucketID(x, y, z, level);
-						if (m_timeStamp[bucket] == m_tick)
+						int cell = findCell(grid, calculateCellKey(x, y, z, level));
+						if (cell == -1)
 							continue;
-						m_timeStamp[bucket] = m_tick;
 
-						for (uint32 i = 0; i < m_objectBucket[bucket].size(); ++i)
+						for (int i = grid.cells[cell].first; i != -1; i = grid.next[i])
 						{
-							Body* body = m_objectBucket[bucket][i].id->pBody;
+							Body* body = grid.bodies[i];
 
 							if (body->queryShape(shape, transform))
 								return true;
@@ -785,12 +1197,11 @@ namespace ong
 	}
 
 
-	bool HGrid::queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData)
+	bool HGrid::queryShape(const Grid& grid, ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData, bool& stop)
 	{
 
-		m_tick++;
 
-		int occupiedLevelsMask = m_occupiedLevelsMask;
+		int occupiedLevelsMask = grid.occupiedLevelsMask;
 
 		AABB aabb = calculateAABB(shape, transform);
 
@@ -829,17 +1240,19 @@ namespace ong
 				{
 					for (int z = z1; z <= z2; ++z)
 					{
-						int bucket = calculateBucketID(x, y, z, level);
-						if (m_timeStamp[bucket] == m_tick)
+						int cell = findCell(grid, calculateCellKey(x, y, z, level));
+						if (cell == -1)
 							continue;
-						m_timeStamp[bucket] = m_tick;
 
-						for (uint32 i = 0; i < m_objectBucket[bucket].size(); ++i)
+						for (int i = grid.cells[cell].first; i != -1; i = grid.next[i])
 						{
-							Body* body = m_objectBucket[bucket][i].id->pBody;
+							Body* body = grid.bodies[i];
 
 							if (!body->queryShape(shape,transform, callback, userData))
+							{
+								stop = true;
 								return true;
+							}
 							else hit = true;
 						}
 
@@ -57,6 +57,29 @@ namespace ong
 	}
 
 
+	void Collider::setCollisionGroup(uint32 collisionGroup)
+	{
+		m_collisionGroup = collisionGroup;
+
+		if (m_pBody)
+		{
+			m_pBody->calculateCollisionFilter();
+			m_pBody->getWorld()->updateProxy(m_pBody->getProxyID());
+		}
+	}
+
+	void Collider::setCollisionFilter(uint32 collisionFilter)
+	{
+		m_collisionFilter = collisionFilter;
+
+		if (m_pBody)
+		{
+			m_pBody->calculateCollisionFilter();
+			m_pBody->getWorld()->updateProxy(m_pBody->getProxyID());
+		}
+	}
+
+
 	void Collider::calculateAABB()
 	{
 		m_aabb = ong::calculateAABB(m_shape, m_transform);
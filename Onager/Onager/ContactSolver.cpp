@@ -10,11 +10,12 @@ namespace ong
 
 
 
-	void preSolveContacts(WorldContext* w, Contact** contacts, int numContacts, float invDt, ContactConstraint* contactConstraints)
+	void preSolveContacts(WorldContext* w, Contact** contacts, int numContacts, float invDt, ContactConstraint* constraints)
 	{
 		for (int i = 0; i < numContacts; ++i)
 		{
 			Contact* c = contacts[i];
+			ContactConstraint* cc = constraints + i;
 
 			Body* a = c->colliderA->getBody();
 			Body* b = c->colliderB->getBody();
@@ -22,6 +23,15 @@ namespace ong
 			int idxA = a->getIndex();
 			int idxB = b->getIndex();
 
+			// static and sleeping bodies are shared between islands, never write to them
+			bool activeA = a->isActive();
+			bool activeB = b->isActive();
+
+			cc->bodyA = idxA;
+			cc->bodyB = idxB;
+			cc->activeA = activeA;
+			cc->activeB = activeB;
+
 			c->friction = sqrt(c->colliderA->getMaterial()->friction * c->colliderB->getMaterial()->friction);
 			c->e = ong_MAX(c->colliderA->getMaterial()->restitution, c->colliderB->getMaterial()->restitution);
 
@@ -41,30 +51,35 @@ namespace ong
 				c->tangent = normalize(cross(man->normal, c->biTangent));
 			}
 
+			cc->numPoints = man->numPoints;
+			cc->normal = man->normal;
+			cc->tangent = c->tangent;
+			cc->biTangent = c->biTangent;
+			cc->friction = c->friction;
 
-			for (int j = 0; j < c->manifold.numPoints; ++j)
+			for (int j = 0; j < man->numPoints; ++j)
 			{
 
-				c->rA[j] = man->points[j].position - w->r[idxA].p;
-				c->rB[j] = man->points[j].position - w->r[idxB].p;
+				cc->rA[j] = man->points[j].position - w->r[idxA].p;
+				cc->rB[j] = man->points[j].position - w->r[idxB].p;
 
-				c->massN[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
-					dot(man->normal, cross(w->m[idxA].invI* cross(c->rA[j], man->normal), c->rA[j]) + cross(w->m[idxB].invI*cross(c->rB[j], man->normal), c->rB[j])));
+				cc->massN[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
+					dot(cc->normal, cross(w->m[idxA].invI* cross(cc->rA[j], cc->normal), cc->rA[j]) + cross(w->m[idxB].invI*cross(cc->rB[j], cc->normal), cc->rB[j])));
 
-				c->massT[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
-					dot(c->tangent, cross(w->m[idxA].invI*cross(c->rA[j], c->tangent), c->rA[j]) + cross(w->m[idxB].invI*cross(c->rB[j], c->tangent), c->rB[j])));
+				cc->massT[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
+					dot(cc->tangent, cross(w->m[idxA].invI*cross(cc->rA[j], cc->tangent), cc->rA[j]) + cross(w->m[idxB].invI*cross(cc->rB[j], cc->tangent), cc->rB[j])));
 
-				c->massBT[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
-					dot(c->biTangent, cross(w->m[idxA].invI*cross(c->rA[j], c->biTangent), c->rA[j]) + cross(w->m[idxB].invI*cross(c->rB[j], c->biTangent), c->rB[j])));
+				cc->massBT[j] = 1.0f / (w->m[idxA].invM + w->m[idxB].invM +
+					dot(cc->biTangent, cross(w->m[idxA].invI*cross(cc->rA[j], cc->biTangent), cc->rA[j]) + cross(w->m[idxB].invI*cross(cc->rB[j], cc->biTangent), cc->rB[j])));
 
 
 
-				vec3 vA = w->v[idxA].v + cross(w->v[idxA].w, c->rA[j]);
-				vec3 vB = w->v[idxB].v + cross(w->v[idxB].w, c->rB[j]);
+				vec3 vA = w->v[idxA].v + cross(w->v[idxA].w, cc->rA[j]);
+				vec3 vB = w->v[idxB].v + cross(w->v[idxB].w, cc->rB[j]);
 
 				vec3 dv = vB - vA;
 
-				float vn = dot(dv, man->normal);
+				float vn = dot(dv, cc->normal);
 
 
 				float penetrationBias = -0.02f * invDt * ong_MIN(0.0f, (man->points[j].penetration + 0.02f));
@@ -76,41 +91,45 @@ namespace ong
 				if (abs(vn) > 1.0f)
 					restititutionBias = -c->e * vn;
 
-				contactConstraints[i].veloctiyBias[j] = penetrationBias + restititutionBias;
+				cc->velocityBias[j] = penetrationBias + restititutionBias;
 
+				cc->accImpulseN[j] = c->accImpulseN[j];
+				cc->accImpulseT[j] = c->accImpulseT[j];
+				cc->accImpulseBT[j] = c->accImpulseBT[j];
 				
 				//warmstarting
-				if (c->accImpulseN[j] != 0.0f || c->accImpulseT[j] != 0.0f || c->accImpulseBT[j] != 0.0f)
+				if (cc->accImpulseN[j] != 0.0f || cc->accImpulseT[j] != 0.0f || cc->accImpulseBT[j] != 0.0f)
 				{
-					vec3 impulse = c->accImpulseN[j] * c->manifold.normal + c->accImpulseT[j] * c->tangent + c->accImpulseBT[j] * c->biTangent;
-
-					w->v[idxA].v -= w->m[idxA].invM * impulse;
-					w->v[idxB].v += w->m[idxB].invM * impulse;
-
-					w->v[idxA].w -= w->m[idxA].invI * cross(c->rA[j], impulse);
-					w->v[idxB].w += w->m[idxB].invI * cross(c->rA[j], impulse);
-
+					vec3 impulse = cc->accImpulseN[j] * cc->normal + cc->accImpulseT[j] * cc->tangent + cc->accImpulseBT[j] * cc->biTangent;
+
+					if (activeA)
+					{
+						w->v[idxA].v -= w->m[idxA].invM * impulse;
+						w->v[idxA].w -= w->m[idxA].invI * cross(cc->rA[j], impulse);
+					}
+					if (activeB)
+					{
+						w->v[idxB].v += w->m[idxB].invM * impulse;
+						w->v[idxB].w += w->m[idxB].invI * cross(cc->rB[j], impulse);
+					}
 				}
 			}
 		}
 	}
 
 
-	void solveContacts(WorldContext* w, Contact** contacts, int numContacts, ContactConstraint* constraints)
+	float solveContacts(WorldContext* w, ContactConstraint* constraints, int numConstraints)
 	{
-		for (int j = 0; j < numContacts; ++j)
-		{
-			Contact* c = contacts[j];
+		float maxDelta = 0.0f;
 
-			Body* a = c->colliderA->getBody();
-			Body* b = c->colliderB->getBody();
-
-			int idxA = a->getIndex();
-			int idxB = b->getIndex();
+		for (int j = 0; j < numConstraints; ++j)
+		{
+			ContactConstraint* c = constraints + j;
 
+			int idxA = c->bodyA;
+			int idxB = c->bodyB;
 
-			ContactManifold* man = &c->manifold;
-			for (int i = 0; i < man->numPoints; ++i)
+			for (int i = 0; i < c->numPoints; ++i)
 			{
 
 				vec3 vA = w->v[idxA].v + cross(w->v[idxA].w, c->rA[i]);
@@ -119,23 +138,29 @@ namespace ong
 				vec3 dv = vB - vA;
 				
 
-				float vn = dot(dv, man->normal);
+				float vn = dot(dv, c->normal);
 
-				float dImpulseN = (-vn + constraints[j].veloctiyBias[i]) * c->massN[i];
+				float dImpulseN = (-vn + c->velocityBias[i]) * c->massN[i];
 
 				// clamp accumulated impulse
 				float impulseN0 = c->accImpulseN[i];
 				c->accImpulseN[i] = ong_MAX(impulseN0 + dImpulseN, 0.0f);
 				dImpulseN = c->accImpulseN[i] - impulseN0;
 
+				maxDelta = ong_MAX(maxDelta, abs(dImpulseN));
 
-				vec3 impulse = dImpulseN * man->normal;
+				vec3 impulse = dImpulseN * c->normal;
 
-				w->v[idxA].v -= w->m[idxA].invM * (impulse);
-				w->v[idxB].v += w->m[idxB].invM * (impulse);
-								
-				w->v[idxA].w -= w->m[idxA].invI * (cross(c->rA[i], impulse));
-				w->v[idxB].w += w->m[idxB].invI * (cross(c->rB[i], impulse));
+				if (c->activeA)
+				{
+					w->v[idxA].v -= w->m[idxA].invM * (impulse);
+					w->v[idxA].w -= w->m[idxA].invI * (cross(c->rA[i], impulse));
+				}
+				if (c->activeB)
+				{
+					w->v[idxB].v += w->m[idxB].invM * (impulse);
+					w->v[idxB].w += w->m[idxB].invI * (cross(c->rB[i], impulse));
+				}
 
 				// friction
 				if (c->friction <= 0.0f)
@@ -162,18 +187,25 @@ namespace ong
 				c->accImpulseBT[i] = ong_clamp(impulseBT0 + dImpulseBT, -maxImpulse, maxImpulse);
 				dImpulseBT = c->accImpulseBT[i] - impulseBT0;
 
+				maxDelta = ong_MAX(maxDelta, ong_MAX(abs(dImpulseT), abs(dImpulseBT)));
 				
 				impulse = dImpulseT * c->tangent + dImpulseBT * c->biTangent;
 				
-
-				w->v[idxA].v -= w->m[idxA].invM * (impulse);
-				w->v[idxB].v += w->m[idxB].invM * (impulse);
-										  
-				w->v[idxA].w -= w->m[idxA].invI * (cross(c->rA[i], impulse));
-				w->v[idxB].w += w->m[idxB].invI * (cross(c->rB[i], impulse));
+				if (c->activeA)
+				{
+					w->v[idxA].v -= w->m[idxA].invM * (impulse);
+					w->v[idxA].w -= w->m[idxA].invI * (cross(c->rA[i], impulse));
+				}
+				if (c->activeB)
+				{
+					w->v[idxB].v += w->m[idxB].invM * (impulse);
+					w->v[idxB].w += w->m[idxB].invI * (cross(c->rB[i], impulse));
+				}
 
 			}
 		}
+
+		return maxDelta;
 	}
 
 
@@ -182,34 +214,41 @@ namespace ong
 		for (int i = 0; i < numContacts; ++i)
 		{
 			Contact* c = contacts[i];
+			ContactConstraint* cc = constraints + i;
 
-			Body* a = c->colliderA->getBody();
-			Body* b = c->colliderB->getBody();
-
-			int idxA = a->getIndex();
-			int idxB = b->getIndex();
+			int idxA = cc->bodyA;
+			int idxB = cc->bodyB;
 
-			c->colliderA->callbackPostSolve(c);
-			c->colliderB->callbackPostSolve(c);
-
-			for (int j = 0; j < contacts[i]->manifold.numPoints; ++j)
+			for (int j = 0; j < cc->numPoints; ++j)
 			{
-			
-
-				vec3 impulse = c->accImpulseN[j] * c->manifold.normal + c->accImpulseT[j] * c->tangent + c->accImpulseBT[j] * c->biTangent;
+				c->accImpulseN[j] = cc->accImpulseN[j];
+				c->accImpulseT[j] = cc->accImpulseT[j];
+				c->accImpulseBT[j] = cc->accImpulseBT[j];
 
-				w->p[idxA].l -= impulse;
-				w->p[idxB].l += impulse;
+				vec3 impulse = cc->accImpulseN[j] * cc->normal + cc->accImpulseT[j] * cc->tangent + cc->accImpulseBT[j] * cc->biTangent;
 
-				w->p[idxA].a -= cross(c->rA[j], impulse);
-				w->p[idxB].a += cross(c->rB[j], impulse);
+				if (cc->activeA)
+				{
+					w->p[idxA].l -= impulse;
+					w->p[idxA].a -= cross(cc->rA[j], impulse);
+				}
+				if (cc->activeB)
+				{
+					w->p[idxB].l += impulse;
+					w->p[idxB].a += cross(cc->rB[j], impulse);
+				}
 			}
 
-			w->v[idxA].v = w->m[idxA].invM * w->p[idxA].l;
-			w->v[idxB].v = w->m[idxB].invM * w->p[idxB].l;
-
-			w->v[idxA].w = w->m[idxA].invI*w->p[idxA].a;
-			w->v[idxB].w = w->m[idxB].invI*w->p[idxB].a;
+			if (cc->activeA)
+			{
+				w->v[idxA].v = w->m[idxA].invM * w->p[idxA].l;
+				w->v[idxA].w = w->m[idxA].invI*w->p[idxA].a;
+			}
+			if (cc->activeB)
+			{
+				w->v[idxB].v = w->m[idxB].invM * w->p[idxB].l;
+				w->v[idxB].w = w->m[idxB].invI*w->p[idxB].a;
+			}
 		}
 	}
 }
@@ -0,0 +1,354 @@
+#include "ContactSolverSIMD.h"
+
+#include "States.h"
+#include "Allocator.h"
+#include <string.h>
+
+namespace ong
+{
+
+	static const int MAX_COLORS = 64;
+
+
+	static inline void setLane(__m128& v, int lane, float f)
+	{
+		((float*)&v)[lane] = f;
+	}
+
+	static inline float getLane(const __m128& v, int lane)
+	{
+		return ((const float*)&v)[lane];
+	}
+
+	static inline void setLane(SimdVec3& v, int lane, const vec3& f)
+	{
+		setLane(v.x, lane, f.x);
+		setLane(v.y, lane, f.y);
+		setLane(v.z, lane, f.z);
+	}
+
+	static inline vec3 getLane(const SimdVec3& v, int lane)
+	{
+		return vec3(getLane(v.x, lane), getLane(v.y, lane), getLane(v.z, lane));
+	}
+
+
+	static inline SimdVec3 operator+(const SimdVec3& a, const SimdVec3& b)
+	{
+		SimdVec3 r = { _mm_add_ps(a.x, b.x), _mm_add_ps(a.y, b.y), _mm_add_ps(a.z, b.z) };
+		return r;
+	}
+
+	static inline SimdVec3 operator-(const SimdVec3& a, const SimdVec3& b)
+	{
+		SimdVec3 r = { _mm_sub_ps(a.x, b.x), _mm_sub_ps(a.y, b.y), _mm_sub_ps(a.z, b.z) };
+		return r;
+	}
+
+	static inline SimdVec3 operator*(__m128 s, const SimdVec3& v)
+	{
+		SimdVec3 r = { _mm_mul_ps(s, v.x), _mm_mul_ps(s, v.y), _mm_mul_ps(s, v.z) };
+		return r;
+	}
+
+	static inline __m128 dot(const SimdVec3& a, const SimdVec3& b)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_mul_ps(a.z, b.z));
+	}
+
+	static inline SimdVec3 cross(const SimdVec3& a, const SimdVec3& b)
+	{
+		SimdVec3 r =
+		{
+			_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+			_mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+			_mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))
+		};
+		return r;
+	}
+
+	// m is a row major 3x3 matrix
+	static inline SimdVec3 mul(const __m128* m, const SimdVec3& v)
+	{
+		SimdVec3 r =
+		{
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], v.x), _mm_mul_ps(m[1], v.y)), _mm_mul_ps(m[2], v.z)),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[3], v.x), _mm_mul_ps(m[4], v.y)), _mm_mul_ps(m[5], v.z)),
+			_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[6], v.x), _mm_mul_ps(m[7], v.y)), _mm_mul_ps(m[8], v.z))
+		};
+		return r;
+	}
+
+
+	static void packBody(WorldContext* w, int idx, bool active, int lane, int* bodyIdx, __m128* invM, __m128* invI)
+	{
+		// static and sleeping bodies keep zero mass and zero velocity
+		if (!active)
+		{
+			bodyIdx[lane] = -1;
+			return;
+		}
+
+		bodyIdx[lane] = idx;
+
+		setLane(*invM, lane, w->m[idx].invM);
+		for (int i = 0; i < 3; ++i)
+		{
+			setLane(invI[3 * i + 0], lane, w->m[idx].invI[i].x);
+			setLane(invI[3 * i + 1], lane, w->m[idx].invI[i].y);
+			setLane(invI[3 * i + 2], lane, w->m[idx].invI[i].z);
+		}
+	}
+
+	static void packConstraint(WorldContext* w, ContactConstraint* c, ContactBatch* batch, int lane)
+	{
+		batch->constraints[lane] = c;
+
+		packBody(w, c->bodyA, c->activeA, lane, batch->bodyA, &batch->invMA, batch->invIA);
+		packBody(w, c->bodyB, c->activeB, lane, batch->bodyB, &batch->invMB, batch->invIB);
+
+		setLane(batch->normal, lane, c->normal);
+		setLane(batch->tangent, lane, c->tangent);
+		setLane(batch->biTangent, lane, c->biTangent);
+		setLane(batch->friction, lane, ong_MAX(c->friction, 0.0f));
+
+		for (int j = 0; j < c->numPoints; ++j)
+		{
+			ContactBatch::Point* p = batch->points + j;
+
+			setLane(p->rA, lane, c->rA[j]);
+			setLane(p->rB, lane, c->rB[j]);
+
+			setLane(p->massN, lane, c->massN[j]);
+			setLane(p->massT, lane, c->massT[j]);
+			setLane(p->massBT, lane, c->massBT[j]);
+
+			setLane(p->velocityBias, lane, c->velocityBias[j]);
+
+			setLane(p->accImpulseN, lane, c->accImpulseN[j]);
+			setLane(p->accImpulseT, lane, c->accImpulseT[j]);
+			setLane(p->accImpulseBT, lane, c->accImpulseBT[j]);
+		}
+
+		batch->numPoints = ong_MAX(batch->numPoints, c->numPoints);
+	}
+
+
+	void prepareContactBatches(WorldContext* w, ContactConstraint* constraints, int numConstraints, int numBodies, LinearAllocator* allocator, ContactBatches* out)
+	{
+		// greedy coloring, no awake body may appear twice in one color
+		uint64* usedColors = allocator->allocate<uint64>(numBodies);
+		memset(usedColors, 0, sizeof(uint64) * numBodies);
+
+		int* colors = allocator->allocate<int>(numConstraints);
+		int colorCount[MAX_COLORS] = { 0 };
+
+		out->numOverflow = 0;
+		out->overflow = allocator->allocate<ContactConstraint>(numConstraints);
+		out->overflowSource = allocator->allocate<ContactConstraint*>(numConstraints);
+
+		out->numColors = 0;
+
+		for (int i = 0; i < numConstraints; ++i)
+		{
+			ContactConstraint* c = constraints + i;
+
+			uint64 used = 0;
+			if (c->activeA)
+				used |= usedColors[c->bodyA];
+			if (c->activeB)
+				used |= usedColors[c->bodyB];
+
+			int color = 0;
+			while (color < MAX_COLORS && (used & ((uint64)1 << color)))
+				++color;
+
+			if (color == MAX_COLORS)
+			{
+				colors[i] = -1;
+				out->overflow[out->numOverflow] = *c;
+				out->overflowSource[out->numOverflow] = c;
+				out->numOverflow++;
+				continue;
+			}
+
+			colors[i] = color;
+			colorCount[color]++;
+			out->numColors = ong_MAX(out->numColors, color + 1);
+
+			if (c->activeA)
+				usedColors[c->bodyA] |= ((uint64)1 << color);
+			if (c->activeB)
+				usedColors[c->bodyB] |= ((uint64)1 << color);
+		}
+
+		// one run of batches per color
+		out->colorStart = allocator->allocate<int>(out->numColors + 1);
+		out->colorStart[0] = 0;
+		for (int i = 0; i < out->numColors; ++i)
+			out->colorStart[i + 1] = out->colorStart[i] + (colorCount[i] + SIMD_WIDTH - 1) / SIMD_WIDTH;
+
+		out->numBatches = out->colorStart[out->numColors];
+		out->batches = allocator->allocate<ContactBatch>(out->numBatches);
+		memset(out->batches, 0, sizeof(ContactBatch) * out->numBatches);
+
+		for (int i = 0; i < out->numBatches; ++i)
+		{
+			for (int lane = 0; lane < SIMD_WIDTH; ++lane)
+			{
+				out->batches[i].bodyA[lane] = -1;
+				out->batches[i].bodyB[lane] = -1;
+			}
+		}
+
+		// fill in constraint order to stay deterministic
+		int colorFill[MAX_COLORS] = { 0 };
+		for (int i = 0; i < numConstraints; ++i)
+		{
+			int color = colors[i];
+			if (color == -1)
+				continue;
+
+			int k = colorFill[color]++;
+			ContactBatch* batch = out->batches + out->colorStart[color] + k / SIMD_WIDTH;
+
+			packConstraint(w, constraints + i, batch, k % SIMD_WIDTH);
+		}
+	}
+
+
+	static inline __m128 abs(__m128 v)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+	}
+
+
+	float solveContactBatches(WorldContext* w, ContactBatch* batches, int numBatches)
+	{
+		__m128 maxDelta = _mm_setzero_ps();
+
+		for (int i = 0; i < numBatches; ++i)
+		{
+			ContactBatch* batch = batches + i;
+
+			__m128 zero = _mm_setzero_ps();
+
+			SimdVec3 vA = { zero, zero, zero };
+			SimdVec3 wA = vA;
+			SimdVec3 vB = vA;
+			SimdVec3 wB = vA;
+
+			for (int lane = 0; lane < SIMD_WIDTH; ++lane)
+			{
+				if (batch->bodyA[lane] >= 0)
+				{
+					setLane(vA, lane, w->v[batch->bodyA[lane]].v);
+					setLane(wA, lane, w->v[batch->bodyA[lane]].w);
+				}
+				if (batch->bodyB[lane] >= 0)
+				{
+					setLane(vB, lane, w->v[batch->bodyB[lane]].v);
+					setLane(wB, lane, w->v[batch->bodyB[lane]].w);
+				}
+			}
+
+			for (int j = 0; j < batch->numPoints; ++j)
+			{
+				ContactBatch::Point* p = batch->points + j;
+
+				SimdVec3 dv = (vB + cross(wB, p->rB)) - (vA + cross(wA, p->rA));
+
+				__m128 vn = dot(dv, batch->normal);
+
+				__m128 dImpulseN = _mm_mul_ps(_mm_sub_ps(p->velocityBias, vn), p->massN);
+
+				// clamp accumulated impulse
+				__m128 impulseN0 = p->accImpulseN;
+				p->accImpulseN = _mm_max_ps(_mm_add_ps(impulseN0, dImpulseN), zero);
+				dImpulseN = _mm_sub_ps(p->accImpulseN, impulseN0);
+
+				maxDelta = _mm_max_ps(maxDelta, abs(dImpulseN));
+
+				SimdVec3 impulse = dImpulseN * batch->normal;
+
+				vA = vA - batch->invMA * impulse;
+				wA = wA - mul(batch->invIA, cross(p->rA, impulse));
+				vB = vB + batch->invMB * impulse;
+				wB = wB + mul(batch->invIB, cross(p->rB, impulse));
+
+				// friction
+				dv = (vB + cross(wB, p->rB)) - (vA + cross(wA, p->rA));
+
+				__m128 dImpulseT = _mm_mul_ps(_mm_sub_ps(zero, dot(dv, batch->tangent)), p->massT);
+				__m128 dImpulseBT = _mm_mul_ps(_mm_sub_ps(zero, dot(dv, batch->biTangent)), p->massBT);
+
+				__m128 maxImpulse = _mm_mul_ps(batch->friction, p->accImpulseN);
+				__m128 minImpulse = _mm_sub_ps(zero, maxImpulse);
+
+				__m128 impulseT0 = p->accImpulseT;
+				p->accImpulseT = _mm_min_ps(_mm_max_ps(_mm_add_ps(impulseT0, dImpulseT), minImpulse), maxImpulse);
+				dImpulseT = _mm_sub_ps(p->accImpulseT, impulseT0);
+
+				__m128 impulseBT0 = p->accImpulseBT;
+				p->accImpulseBT = _mm_min_ps(_mm_max_ps(_mm_add_ps(impulseBT0, dImpulseBT), minImpulse), maxImpulse);
+				dImpulseBT = _mm_sub_ps(p->accImpulseBT, impulseBT0);
+
+				maxDelta = _mm_max_ps(maxDelta, _mm_max_ps(abs(dImpulseT), abs(dImpulseBT)));
+
+				impulse = dImpulseT * batch->tangent + dImpulseBT * batch->biTangent;
+
+				vA = vA - batch->invMA * impulse;
+				wA = wA - mul(batch->invIA, cross(p->rA, impulse));
+				vB = vB + batch->invMB * impulse;
+				wB = wB + mul(batch->invIB, cross(p->rB, impulse));
+			}
+
+			for (int lane = 0; lane < SIMD_WIDTH; ++lane)
+			{
+				if (batch->bodyA[lane] >= 0)
+				{
+					w->v[batch->bodyA[lane]].v = getLane(vA, lane);
+					w->v[batch->bodyA[lane]].w = getLane(wA, lane);
+				}
+				if (batch->bodyB[lane] >= 0)
+				{
+					w->v[batch->bodyB[lane]].v = getLane(vB, lane);
+					w->v[batch->bodyB[lane]].w = getLane(wB, lane);
+				}
+			}
+		}
+
+		float result = getLane(maxDelta, 0);
+		for (int lane = 1; lane < SIMD_WIDTH; ++lane)
+			result = ong_MAX(result, getLane(maxDelta, lane));
+
+		return result;
+	}
+
+
+	void finishContactBatches(ContactBatches* batches)
+	{
+		for (int i = 0; i < batches->numBatches; ++i)
+		{
+			ContactBatch* batch = batches->batches + i;
+
+			for (int lane = 0; lane < SIMD_WIDTH; ++lane)
+			{
+				ContactConstraint* c = batch->constraints[lane];
+				if (c == nullptr)
+					continue;
+
+				for (int j = 0; j < c->numPoints; ++j)
+				{
+					c->accImpulseN[j] = getLane(batch->points[j].accImpulseN, lane);
+					c->accImpulseT[j] = getLane(batch->points[j].accImpulseT, lane);
+					c->accImpulseBT[j] = getLane(batch->points[j].accImpulseBT, lane);
+				}
+			}
+		}
+
+		for (int i = 0; i < batches->numOverflow; ++i)
+			*batches->overflowSource[i] = batches->overflow[i];
+	}
+
+}
@@ -0,0 +1,86 @@
+#include "Island.h"
+#include "Body.h"
+#include "Collider.h"
+#include "Contact.h"
+#include "Allocator.h"
+#include <string.h>
+
+namespace ong
+{
+
+
+	static bool isTouching(Contact* c)
+	{
+		return c->manifold.numPoints > 0 && !c->colliderA->isSensor() && !c->colliderB->isSensor();
+	}
+
+
+	void buildIslands(Body** bodies, int numBodies, int numContacts, uint32 tick, LinearAllocator* allocator, IslandSet* islands)
+	{
+		islands->numIslands = 0;
+		islands->islands = allocator->allocate<Island>(numBodies);
+		islands->numBodies = 0;
+		islands->bodies = allocator->allocate<Body*>(numBodies);
+		islands->numContacts = 0;
+		islands->contacts = allocator->allocate<Contact*>(numContacts);
+
+		bool* visited = allocator->allocate<bool>(numBodies);
+		memset(visited, 0, numBodies * sizeof(bool));
+
+		Body** stack = allocator->allocate<Body*>(numBodies);
+
+		for (int i = 0; i < numBodies; ++i)
+		{
+			Body* seed = bodies[i];
+
+			if (visited[i] || !seed->isActive())
+				continue;
+
+			Island* island = islands->islands + islands->numIslands++;
+			island->bodyStart = islands->numBodies;
+			island->numBodies = 0;
+			island->contactStart = islands->numContacts;
+			island->numContacts = 0;
+
+			int stackSize = 0;
+			stack[stackSize++] = seed;
+			visited[i] = true;
+
+			while (stackSize > 0)
+			{
+				Body* b = stack[--stackSize];
+
+				islands->bodies[islands->numBodies++] = b;
+				island->numBodies++;
+
+				for (ContactIter* c = b->getContacts(); c != nullptr; c = c->next)
+				{
+					Contact* contact = c->contact;
+
+					// sensors and contacts without points do not link the islands of their bodies,
+					// solving them would write to a body of another island
+					if (!isTouching(contact))
+						continue;
+
+					if (contact->islandTick != tick)
+					{
+						contact->islandTick = tick;
+						islands->contacts[islands->numContacts++] = contact;
+						island->numContacts++;
+					}
+
+					Body* other = c->other;
+
+					if (other->getType() == BodyType::Static || visited[other->getIndex()])
+						continue;
+
+					other->wakeUp();
+
+					visited[other->getIndex()] = true;
+					stack[stackSize++] = other;
+				}
+			}
+		}
+	}
+
+}
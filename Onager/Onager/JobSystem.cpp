@@ -0,0 +1,132 @@
+#include "JobSystem.h"
+#include "myMath.h"
+#include <assert.h>
+
+namespace ong
+{
+
+
+	JobSystem::JobSystem(int numThreads)
+		: m_generation(0),
+		m_numActiveWorkers(0),
+		m_quit(false),
+		m_func(nullptr),
+		m_userData(nullptr),
+		m_count(0),
+		m_grainSize(1),
+		m_numJobs(0)
+	{
+		m_nextJob = 0;
+		m_numPendingJobs = 0;
+
+		// thread 0 is the calling thread
+		for (int i = 1; i < numThreads; ++i)
+			m_workers.push_back(std::thread(&JobSystem::workerMain, this, i));
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_wake.notify_all();
+
+		for (std::thread& t : m_workers)
+			t.join();
+	}
+
+
+	void JobSystem::parallelFor(int count, int grainSize, JobFunc func, void* userData)
+	{
+		if (count <= 0)
+			return;
+
+		if (grainSize < 1)
+			grainSize = 1;
+
+		int numJobs = (count + grainSize - 1) / grainSize;
+
+		if (m_workers.empty() || numJobs == 1)
+		{
+			// keep the same partition as the threaded path
+			for (int begin = 0; begin < count; begin += grainSize)
+				func(begin, ong_MIN(begin + grainSize, count), 0, userData);
+			return;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			// stragglers of the last batch must be gone before it is overwritten
+			m_done.wait(lock, [this]{ return m_numActiveWorkers == 0; });
+
+			m_func = func;
+			m_userData = userData;
+			m_count = count;
+			m_grainSize = grainSize;
+			m_numJobs = numJobs;
+			m_nextJob = 0;
+			m_numPendingJobs = numJobs;
+
+			m_generation++;
+		}
+		m_wake.notify_all();
+
+		work(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]{ return m_numPendingJobs == 0; });
+	}
+
+
+	void JobSystem::workerMain(int thread)
+	{
+		uint32 generation = 0;
+
+		for (;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this, generation]{ return m_quit || m_generation != generation; });
+
+				if (m_quit)
+					return;
+
+				generation = m_generation;
+				m_numActiveWorkers++;
+			}
+
+			work(thread);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_numActiveWorkers--;
+			}
+			m_done.notify_all();
+		}
+	}
+
+
+	void JobSystem::work(int thread)
+	{
+		for (;;)
+		{
+			int job = m_nextJob++;
+			if (job >= m_numJobs)
+				return;
+
+			int begin = job * m_grainSize;
+			int end = ong_MIN(begin + m_grainSize, m_count);
+
+			m_func(begin, end, thread, m_userData);
+
+			if (--m_numPendingJobs == 0)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_done.notify_all();
+			}
+		}
+	}
+
+}
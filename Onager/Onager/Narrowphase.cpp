@@ -4,18 +4,140 @@
 #include "Collider.h"
 #include "SAT.h"
 #include "BVH.h"
+#include "PairManager.h"
+#include "JobSystem.h"
 #include <float.h>
+#include <cstdint>
 #include <cassert>
+#include <algorithm>
 
 
 namespace ong
 {
 
 
+	ContactCache::ContactCache(int numSlots)
+		: m_numUsedSlots(0)
+	{
+		int n = 1;
+		while (n < numSlots)
+			n <<= 1;
+
+		Slot empty = { nullptr, nullptr, nullptr };
+		m_slots.resize(n, empty);
+	}
+
+	uint32 ContactCache::hash(const Collider* a, const Collider* b)
+	{
+		uint64 key = (uint64)(uintptr_t)a * 0x9e3779b97f4a7c15ull ^ (uint64)(uintptr_t)b;
+
+		// murmur3 finalizer
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+
+		return (uint32)key;
+	}
+
+	int ContactCache::findSlot(const Collider* a, const Collider* b) const
+	{
+		if (b < a)
+			std::swap(a, b);
+
+		int mask = (int)m_slots.size() - 1;
+
+		for (int slot = hash(a, b) & mask; m_slots[slot].colliderPair != nullptr; slot = (slot + 1) & mask)
+		{
+			if (m_slots[slot].a == a && m_slots[slot].b == b)
+				return slot;
+		}
+
+		return -1;
+	}
+
+	ColliderPair* ContactCache::find(const Collider* a, const Collider* b) const
+	{
+		int slot = findSlot(a, b);
+		return slot != -1 ? m_slots[slot].colliderPair : nullptr;
+	}
+
+	void ContactCache::insert(ColliderPair* colliderPair)
+	{
+		const Collider* a = colliderPair->colliderA;
+		const Collider* b = colliderPair->colliderB;
+		if (b < a)
+			std::swap(a, b);
+
+		assert(findSlot(a, b) == -1);
+
+		int mask = (int)m_slots.size() - 1;
+		int slot = hash(a, b) & mask;
+		while (m_slots[slot].colliderPair != nullptr)
+			slot = (slot + 1) & mask;
+
+		m_slots[slot].a = a;
+		m_slots[slot].b = b;
+		m_slots[slot].colliderPair = colliderPair;
+
+		if (2 * ++m_numUsedSlots > (int)m_slots.size())
+			rehash(2 * (int)m_slots.size());
+	}
+
+	void ContactCache::remove(const ColliderPair* colliderPair)
+	{
+		int slot = findSlot(colliderPair->colliderA, colliderPair->colliderB);
+		assert(slot != -1 && m_slots[slot].colliderPair == colliderPair);
+
+		int mask = (int)m_slots.size() - 1;
+
+		// shift following slots back so probing never stops early
+		for (int i = (slot + 1) & mask; m_slots[i].colliderPair != nullptr; i = (i + 1) & mask)
+		{
+			int home = hash(m_slots[i].a, m_slots[i].b) & mask;
+
+			// the slot may move if its home is not in (slot, i]
+			if (((i - home) & mask) >= ((i - slot) & mask))
+			{
+				m_slots[slot] = m_slots[i];
+				slot = i;
+			}
+		}
+
+		m_slots[slot].colliderPair = nullptr;
+		m_numUsedSlots--;
+	}
+
+	void ContactCache::rehash(int numSlots)
+	{
+		Slot empty = { nullptr, nullptr, nullptr };
+		std::vector<Slot> slots(numSlots, empty);
+
+		m_slots.swap(slots);
+
+		int mask = numSlots - 1;
+		for (const Slot& s : slots)
+		{
+			if (s.colliderPair == nullptr)
+				continue;
+
+			int slot = hash(s.a, s.b) & mask;
+			while (m_slots[slot].colliderPair != nullptr)
+				slot = (slot + 1) & mask;
+
+			m_slots[slot] = s;
+		}
+	}
+
+
+
 	ContactManager::ContactManager()
 		: m_contactAllocator(64),
 		m_contactIterAllocator(128),
-		m_tick(0)
+		m_colliderPairAllocator(128),
+		m_tick(0),
+		m_pairManager(nullptr)
 	{
 
 	}
@@ -419,7 +541,7 @@ namespace ong
 
 
 
-	void ContactManager::collide(BVTree* tree1, BVTree* tree2, BVTree* a, BVTree* b, const vec3& t, const mat3x3& rot)
+	void ContactManager::collide(BVTree* tree1, BVTree* tree2, BVTree* a, BVTree* b, const vec3& t, const mat3x3& rot, int pair, std::vector<Collision>* collisions) const
 	{
 		if (!overlap(a->aabb, b->aabb, t, rot))
 			return;
@@ -428,50 +550,50 @@ namespace ong
 		{
 			if (b->type == NodeType::LEAF)
 			{
-				collide(a->collider, b->collider);
+				collide(a->collider, b->collider, pair, collisions);
 			}
 			else
 			{
-				collide(tree1, tree2, a, tree2 + b->left, t, rot);
-				collide(tree1, tree2, a, tree2 + b->right, t, rot);
+				collide(tree1, tree2, a, tree2 + b->left, t, rot, pair, collisions);
+				collide(tree1, tree2, a, tree2 + b->right, t, rot, pair, collisions);
 			}
 		}
 		else
 		{
 			if (b->type == NodeType::LEAF)
 			{
-				collide(tree1, tree2, tree1 + a->left, b, t, rot);
-				collide(tree1, tree2, tree1 + a->right, b, t, rot);
+				collide(tree1, tree2, tree1 + a->left, b, t, rot, pair, collisions);
+				collide(tree1, tree2, tree1 + a->right, b, t, rot, pair, collisions);
 			}
 			else
 			{
-				collide(tree1, tree2, tree1 + a->left, tree2 + b->left, t, rot);
-				collide(tree1, tree2, tree1 + a->left, tree2 + b->right, t, rot);
-				collide(tree1, tree2, tree1 + a->right, tree2 + b->left, t, rot);
-				collide(tree1, tree2, tree1 + a->right, tree2 + b->right, t, rot);
+				collide(tree1, tree2, tree1 + a->left, tree2 + b->left, t, rot, pair, collisions);
+				collide(tree1, tree2, tree1 + a->left, tree2 + b->right, t, rot, pair, collisions);
+				collide(tree1, tree2, tree1 + a->right, tree2 + b->left, t, rot, pair, collisions);
+				collide(tree1, tree2, tree1 + a->right, tree2 + b->right, t, rot, pair, collisions);
 			}
 		}
 
 	}
 
-	void ContactManager::collide(BVTree* tree, BVTree* a, Collider* b, const vec3& t, const mat3x3& rot)
+	void ContactManager::collide(BVTree* tree, BVTree* a, Collider* b, const vec3& t, const mat3x3& rot, int pair, std::vector<Collision>* collisions) const
 	{
 		if (!overlap(a->aabb, b->getAABB(), t, rot))
 			return;
 
 		if (a->type == NodeType::LEAF)
 		{
-			collide(a->collider, b);
+			collide(a->collider, b, pair, collisions);
 		}
 		else
 		{
-			collide(tree, tree + a->left, b, t, rot);
-			collide(tree, tree + a->right, b, t, rot);
+			collide(tree, tree + a->left, b, t, rot, pair, collisions);
+			collide(tree, tree + a->right, b, t, rot, pair, collisions);
 		}
 	}
 
 
-	void ContactManager::collide(Collider* ca, Collider* cb)
+	void ContactManager::collide(Collider* ca, Collider* cb, int pair, std::vector<Collision>* collisions) const
 	{
 		typedef void(*CollisionFunc)(Collider* a, Transform* ta, Collider* b, Transform* tb, ContactManifold* manifold, Feature* feature);
 		static const CollisionFunc collisionFuncMatrix[ShapeType::COUNT][ShapeType::COUNT]
@@ -498,7 +620,15 @@ namespace ong
 
 		ContactManifold manifold;
 		Feature feature;
-		
+
+		// start from the feature of the last frame,
+		// the cache is only modified after all pairs are collided
+		const ColliderPair* colliderPair = m_contactCache.find(ca, cb);
+		if (colliderPair != nullptr && colliderPair->colliderA == ca)
+			feature = colliderPair->feature;
+		else
+			feature.type = Feature::NONE;
+
 		// check if either collider is a sensor
 		if (ca->isSensor() || cb->isSensor())
 		{
@@ -512,49 +642,85 @@ namespace ong
 			collisionFuncMatrix[ca->getShape().getType()][cb->getShape().getType()](ca, &ta, cb, &tb, &manifold, &feature);
 
 			if (manifold.numPoints == 0)
+			{
+				// only a new separating axis has to be stored
+				if (feature.type == Feature::NONE || (colliderPair != nullptr && colliderPair->colliderA == ca && colliderPair->feature == feature))
+					return;
+
+				Collision collision = { ca, cb, pair, false, manifold, feature };
+				collisions->push_back(collision);
 				return;
+			}
 		}
-		
 
-		Contact* contact = nullptr;
+		Collision collision = { ca, cb, pair, true, manifold, feature };
+		collisions->push_back(collision);
+	}
 
-		// check if contact already exists
-		for (ContactIter* i = a->getContacts(); i != 0; i = i->next)
+	void ContactManager::updateContact(const Collision& collision)
+	{
+		Collider* ca = collision.colliderA;
+		Collider* cb = collision.colliderB;
+		const ContactManifold& manifold = collision.manifold;
+		const Feature& feature = collision.feature;
+
+		Body* a = ca->getBody();
+		Body* b = cb->getBody();
+
+		ColliderPair* colliderPair = m_contactCache.find(ca, cb);
+
+		if (colliderPair == nullptr)
 		{
-			if (i->other == b &&
-				(i->contact->colliderA == ca || i->contact->colliderB == ca) &&
-				(i->contact->colliderA == cb || i->contact->colliderB == cb))
-			{
+			PersistentPair& persistentPair = m_pairManager->getPair(collision.pair);
 
-				contact = i->contact;
-				
-				contact->manifold = manifold;
-				
+			colliderPair = m_colliderPairAllocator();
+			colliderPair->colliderA = ca;
+			colliderPair->colliderB = cb;
+			colliderPair->contact = nullptr;
 
-				// if features are different do not warmstart
-				if (i->contact->colliderA != ca || i->contact->colliderB != cb ||
-					!(i->contact->feature == feature))
-				{
-					for (int j = 0; j < contact->manifold.numPoints; ++j)
-					{
-						contact->accImpulseN[j] = 0.0f;
-						contact->accImpulseT[j] = 0.0f;
-						contact->accImpulseBT[j] = 0.0f;
-					}
+			colliderPair->next = persistentPair.colliderPairs;
+			persistentPair.colliderPairs = colliderPair;
+
+			m_contactCache.insert(colliderPair);
+		}
+
+		// the feature belongs to the order it was found with
+		colliderPair->colliderA = ca;
+		colliderPair->colliderB = cb;
+		colliderPair->feature = feature;
+
+		if (!collision.touching)
+			return;
+
+		// check if contact already exists
+		Contact* contact = colliderPair->contact;
+
+		if (contact != nullptr)
+		{
+			contact->manifold = manifold;
 
-					contact->feature = feature;
-					contact->colliderA = ca;
-					contact->colliderB = cb;
+			// if features are different do not warmstart
+			if (contact->colliderA != ca || contact->colliderB != cb ||
+				!(contact->feature == feature))
+			{
+				for (int j = 0; j < contact->manifold.numPoints; ++j)
+				{
+					contact->accImpulseN[j] = 0.0f;
+					contact->accImpulseT[j] = 0.0f;
+					contact->accImpulseBT[j] = 0.0f;
 				}
 
-				break;
+				contact->colliderA = ca;
+				contact->colliderB = cb;
 			}
 
+			// keeps the relative transform the feature was found with
+			contact->feature = feature;
 		}
-
-		if (contact == nullptr) //create new contact
+		else //create new contact
 		{
 			contact = m_contactAllocator();
+			contact->index = (int)m_contacts.size();
 			m_contacts.push_back(contact);
 
 			contact->colliderA = ca;
@@ -563,6 +729,8 @@ namespace ong
 			contact->manifold = manifold;
 			contact->feature = feature;
 
+			colliderPair->contact = contact;
+
 			ContactIter* iterA = m_contactIterAllocator();
 			ContactIter* iterB = m_contactIterAllocator();
 
@@ -576,6 +744,9 @@ namespace ong
 			a->addContact(iterA);
 			b->addContact(iterB);
 
+			contact->iterA = iterA;
+			contact->iterB = iterB;
+
 			for (int i = 0; i < contact->manifold.numPoints; ++i)
 			{
 				contact->accImpulseN[i] = 0.0f;
@@ -593,7 +764,7 @@ namespace ong
 		contact->tick = m_tick;
 	}
 
-    void ContactManager::collide(Body*a, Body*b)
+    void ContactManager::collide(Body*a, Body*b, int pair, std::vector<Collision>* collisions) const
     {
 		if (a->getNumCollider() == 0 || b->getNumCollider() == 0)
 			return;
@@ -603,7 +774,7 @@ namespace ong
             Transform t = invTransformTransform(b->getTransform(), a->getTransform());
             mat3x3 rot = toRotMat(t.q);
 
-            collide(a->getBVTree(), b->getBVTree(), a->getBVTree(), b->getBVTree(), t.p, rot);
+            collide(a->getBVTree(), b->getBVTree(), a->getBVTree(), b->getBVTree(), t.p, rot, pair, collisions);
 
         }
         else if (a->getNumCollider() > 1)
@@ -611,7 +782,7 @@ namespace ong
             Transform t = invTransformTransform(b->getTransform(), a->getTransform());
             mat3x3 rot = toRotMat(t.q);
 
-            collide(a->getBVTree(), a->getBVTree(), b->getCollider(), t.p, rot);
+            collide(a->getBVTree(), a->getBVTree(), b->getCollider(), t.p, rot, pair, collisions);
 
         }
         else if (b->getNumCollider() > 1)
@@ -619,34 +790,65 @@ namespace ong
             Transform t = invTransformTransform(a->getTransform(), b->getTransform());
             mat3x3 rot = toRotMat(t.q);
 
-            collide(b->getBVTree(), b->getBVTree(), a->getCollider(), t.p, rot);
+            collide(b->getBVTree(), b->getBVTree(), a->getCollider(), t.p, rot, pair, collisions);
         }
         else if (a->getNumCollider() == 1 && b->getNumCollider() == 1)
         {
-            collide(a->getCollider(), b->getCollider());
+            collide(a->getCollider(), b->getCollider(), pair, collisions);
         }
     }
 
 
-	void ContactManager::generateContacts(Pair* pairs, int numPairs, int maxContacts)
+	void ContactManager::generateContacts(const Pair* pairs, const int* ids, int numPairs, int maxContacts, JobSystem* jobSystem)
 	{
 		m_tick++;
 
+		releaseColliderPairs();
+
 		m_contacts.reserve(maxContacts);
 
+		// every job collides its pairs into its own buffer
+		int numJobs = (numPairs + PAIR_GRAIN_SIZE - 1) / PAIR_GRAIN_SIZE;
+		if ((int)m_jobCollisions.size() < numJobs)
+			m_jobCollisions.resize(numJobs);
+
+		auto job = [=](int begin, int end, int)
+		{
+			std::vector<Collision>& collisions = m_jobCollisions[begin / PAIR_GRAIN_SIZE];
+			collisions.clear();
 
-		for (int i = 0; i < numPairs; ++i)
+			for (int i = begin; i < end; ++i)
+				collide(pairs[i].A, pairs[i].B, ids[i], &collisions);
+		};
+
+		if (jobSystem != nullptr)
+		{
+			jobSystem->parallelFor(numPairs, PAIR_GRAIN_SIZE, job);
+		}
+		else
 		{
-			Body* a = pairs[i].A;
-			Body* b = pairs[i].B;
+			for (int begin = 0; begin < numPairs; begin += PAIR_GRAIN_SIZE)
+				job(begin, ong_MIN(begin + PAIR_GRAIN_SIZE, numPairs), 0);
+		}
 
-			collide(a, b);
+		// contacts are created in pair order, independent of the number of threads
+		for (int i = 0; i < numJobs; ++i)
+		{
+			for (int j = 0; j < (int)m_jobCollisions[i].size(); ++j)
+				updateContact(m_jobCollisions[i][j]);
 		}
 
 		for (unsigned int i = 0; i < m_contacts.size(); ++i)
 		{
 			if (m_contacts[i]->tick != m_tick) //old contact
 			{
+				// contacts of sleeping bodies are not collided, keep them
+				if (!m_contacts[i]->colliderA->getBody()->isActive() && !m_contacts[i]->colliderB->getBody()->isActive())
+				{
+					m_contacts[i]->tick = m_tick;
+					continue;
+				}
+
 				removeContact(i);
 				--i;
 			}
@@ -662,50 +864,128 @@ namespace ong
 	
 	void ContactManager::removeBody(Body* body)
 	{
-		for (ContactIter* c = body->getContacts(); c != 0; c = c->next)
+		while (body->getContacts() != nullptr)
+			removeContact(body->getContacts()->contact->index);
+	}
+
+	void ContactManager::removeBodies(Body* const* bodies, int numBodies)
+	{
+		// mark the contacts first, contacts between two of the bodies are marked twice
+		for (int i = 0; i < numBodies; ++i)
 		{
-            for (unsigned int i = 0; i < m_contacts.size(); ++i)
-			{
-				if (m_contacts[i] == c->contact)
-				{
-					removeContact(i);
-					break;
-				}
+			for (ContactIter* c = bodies[i]->getContacts(); c != nullptr; c = c->next)
+				c->contact->index = -1;
+		}
+
+		int numContacts = 0;
+		for (int i = 0; i < (int)m_contacts.size(); ++i)
+		{
+			Contact* c = m_contacts[i];
 
+			if (c->index == -1)
+			{
+				releaseContact(c);
+				continue;
 			}
+
+			c->index = numContacts;
+			m_contacts[numContacts++] = c;
 		}
+
+		m_contacts.resize(numContacts);
 	}
 
 	void ContactManager::removeContact(Contact* pContact)
 	{
-		for (size_t i = 0; i < m_contacts.size(); ++i)
+		assert(m_contacts[pContact->index] == pContact);
+		removeContact(pContact->index);
+	}
+
+	void ContactManager::removeContact(int contact)
+	{
+		releaseContact(m_contacts[contact]);
+
+		m_contacts[contact] = m_contacts.back();
+		m_contacts[contact]->index = contact;
+		m_contacts.pop_back();
+	}
+
+	void ContactManager::removeCollider(Collider* collider)
+	{
+		m_removedColliders.push_back(collider);
+	}
+
+	void ContactManager::releaseColliderPairs()
+	{
+		// the state lives as long as the broadphase pair
+		const std::vector<int>& endPairs = m_pairManager->getEndPairs();
+		for (int i = 0; i < (int)endPairs.size(); ++i)
 		{
-			if (m_contacts[i] == pContact)
+			PersistentPair& pair = m_pairManager->getPair(endPairs[i]);
+
+			while (pair.colliderPairs != nullptr)
 			{
-				removeContact(i);
-				break;
+				ColliderPair* colliderPair = pair.colliderPairs;
+				pair.colliderPairs = colliderPair->next;
+				releaseColliderPair(colliderPair);
 			}
 		}
+
+		if (m_removedColliders.empty())
+			return;
+
+		// removed colliders may be reused at the same address, drop their state before colliding
+		std::sort(m_removedColliders.begin(), m_removedColliders.end());
+
+		for (int i = 0; i < m_pairManager->getNumPairIDs(); ++i)
+		{
+			ColliderPair** link = &m_pairManager->getPair(i).colliderPairs;
+			while (*link != nullptr)
+			{
+				ColliderPair* colliderPair = *link;
+
+				if (std::binary_search(m_removedColliders.begin(), m_removedColliders.end(), colliderPair->colliderA) ||
+					std::binary_search(m_removedColliders.begin(), m_removedColliders.end(), colliderPair->colliderB))
+				{
+					*link = colliderPair->next;
+					releaseColliderPair(colliderPair);
+				}
+				else
+				{
+					link = &colliderPair->next;
+				}
+			}
+		}
+
+		m_removedColliders.clear();
 	}
 
-	void ContactManager::removeContact(int contact)
+	void ContactManager::releaseColliderPair(ColliderPair* colliderPair)
+	{
+		m_contactCache.remove(colliderPair);
+		m_colliderPairAllocator.sDelete(colliderPair);
+	}
+
+	void ContactManager::releaseContact(Contact* c)
 	{
-		m_contacts[contact]->colliderA->callbackEndContact(m_contacts[contact]);
-		m_contacts[contact]->colliderB->callbackEndContact(m_contacts[contact]);
+		c->colliderA->callbackEndContact(c);
+		c->colliderB->callbackEndContact(c);
+
+		// support might be gone
+		c->colliderA->getBody()->wakeUp();
+		c->colliderB->getBody()->wakeUp();
 
 		//remove contacts from bodies
-		Body* a = m_contacts[contact]->colliderA->getBody();
-		Body* b = m_contacts[contact]->colliderB->getBody();
+		c->iterB->other->removeContact(c->iterA);
+		c->iterA->other->removeContact(c->iterB);
 
-		ContactIter* iterA = a->removeContact(m_contacts[contact]);
-		ContactIter* iterB = b->removeContact(m_contacts[contact]);
-		
-		m_contactIterAllocator.sDelete(iterA);
-		m_contactIterAllocator.sDelete(iterB);
+		m_contactIterAllocator.sDelete(c->iterA);
+		m_contactIterAllocator.sDelete(c->iterB);
 
-		m_contactAllocator.sDelete(m_contacts[contact]);
+		ColliderPair* colliderPair = m_contactCache.find(c->colliderA, c->colliderB);
+		if (colliderPair != nullptr && colliderPair->contact == c)
+			colliderPair->contact = nullptr;
 
-		m_contacts[contact] = m_contacts.back();
-		m_contacts.pop_back();
+		m_contactAllocator.sDelete(c);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "PairManager.h"
+#include "Broadphase.h"
+#include "Body.h"
+#include <functional>
+#include <algorithm>
+
+
+namespace ong
+{
+
+	PairManager::PairManager()
+		: m_tick(0)
+	{
+	}
+
+
+	size_t PairManager::KeyHash::operator()(const Key& key) const
+	{
+		size_t h = std::hash<Body*>()(key.a);
+		return h ^ (std::hash<Body*>()(key.b) + 0x9e3779b9 + (h << 6) + (h >> 2));
+	}
+
+	bool PairManager::KeyEqual::operator()(const Key& lhs, const Key& rhs) const
+	{
+		return lhs.a == rhs.a && lhs.b == rhs.b;
+	}
+
+	PairManager::Key PairManager::makeKey(Body* a, Body* b)
+	{
+		Key key;
+		if (std::less<Body*>()(a, b))
+			key.a = a, key.b = b;
+		else
+			key.a = b, key.b = a;
+		return key;
+	}
+
+
+	int PairManager::allocatePair()
+	{
+		if (m_freePairs.empty())
+		{
+			m_pairs.push_back(PersistentPair());
+			return (int)m_pairs.size() - 1;
+		}
+
+		int id = m_freePairs.back();
+		m_freePairs.pop_back();
+		return id;
+	}
+
+	void PairManager::endPair(int id)
+	{
+		PersistentPair& pair = m_pairs[id];
+
+		m_index.erase(makeKey(pair.A, pair.B));
+		pair.ended = true;
+
+		m_end.push_back(id);
+	}
+
+
+	void PairManager::update(const Pair* pairs, int numPairs, int* ids)
+	{
+		// pairs that ended during the last update can be reused now
+		for (int i = 0; i < (int)m_end.size(); ++i)
+		{
+			m_pairs[m_end[i]].A = nullptr;
+			m_freePairs.push_back(m_end[i]);
+		}
+
+		m_begin.clear();
+		m_end.clear();
+
+		m_tick++;
+
+		// end the pairs of removed bodies before their addresses can be matched again
+		if (!m_removedBodies.empty())
+		{
+			std::sort(m_removedBodies.begin(), m_removedBodies.end());
+
+			for (int i = 0; i < (int)m_pairs.size(); ++i)
+			{
+				PersistentPair& pair = m_pairs[i];
+
+				if (pair.A == nullptr || pair.ended)
+					continue;
+
+				if (std::binary_search(m_removedBodies.begin(), m_removedBodies.end(), pair.A) ||
+					std::binary_search(m_removedBodies.begin(), m_removedBodies.end(), pair.B))
+					endPair(i);
+			}
+
+			m_removedBodies.clear();
+		}
+
+		for (int i = 0; i < numPairs; ++i)
+		{
+			Key key = makeKey(pairs[i].A, pairs[i].B);
+
+			std::unordered_map<Key, int, KeyHash, KeyEqual>::iterator it = m_index.find(key);
+			if (it != m_index.end())
+			{
+				ids[i] = it->second;
+			}
+			else
+			{
+				int id = allocatePair();
+
+				PersistentPair& pair = m_pairs[id];
+				pair.A = pairs[i].A;
+				pair.B = pairs[i].B;
+				pair.colliderPairs = nullptr;
+				pair.ended = false;
+
+				m_index[key] = id;
+				m_begin.push_back(id);
+
+				ids[i] = id;
+			}
+
+			m_pairs[ids[i]].tick = m_tick;
+		}
+
+		for (int i = 0; i < (int)m_pairs.size(); ++i)
+		{
+			PersistentPair& pair = m_pairs[i];
+
+			if (pair.A == nullptr || pair.ended || pair.tick == m_tick)
+				continue;
+
+			// pairs of sleeping bodies are not reported, keep them
+			if (!pair.A->isActive() && !pair.B->isActive())
+			{
+				pair.tick = m_tick;
+				continue;
+			}
+
+			endPair(i);
+		}
+	}
+
+
+	void PairManager::removeBody(Body* body)
+	{
+		m_removedBodies.push_back(body);
+	}
+
+	void PairManager::removeBodies(Body* const* bodies, int numBodies)
+	{
+		m_removedBodies.insert(m_removedBodies.end(), bodies, bodies + numBodies);
+	}
+
+}
@@ -0,0 +1,69 @@
+#include "RayPacket.h"
+#include <float.h>
+
+namespace ong
+{
+
+
+	void setRayPacket(RayPacket* packet, const vec3* origins, const vec3* dirs, int count)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			float o[RAY_PACKET_SIZE], d[RAY_PACKET_SIZE], ooDir[RAY_PACKET_SIZE];
+			for (int k = 0; k < RAY_PACKET_SIZE; ++k)
+			{
+				int ray = k < count ? k : 0;
+				o[k] = origins[ray][i];
+				d[k] = dirs[ray][i];
+				ooDir[k] = abs(d[k]) < FLT_EPSILON ? 1e30f : 1.0f / d[k];
+			}
+			packet->origin[i] = _mm_loadu_ps(o);
+			packet->dir[i] = _mm_loadu_ps(d);
+			packet->ooDir[i] = _mm_loadu_ps(ooDir);
+		}
+	}
+
+
+	int intersectRayPacketAABB(const RayPacket& packet, const AABB& aabb, __m128 tmax)
+	{
+		__m128 tNear = _mm_setzero_ps();
+		__m128 tFar = _mm_set1_ps(FLT_MAX);
+		for (int i = 0; i < 3; ++i)
+		{
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.c[i] - aabb.e[i]), packet.origin[i]), packet.ooDir[i]);
+			__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(aabb.c[i] + aabb.e[i]), packet.origin[i]), packet.ooDir[i]);
+
+			tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+			tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+		}
+
+		return _mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmple_ps(tNear, tmax)));
+	}
+
+
+	int intersectRayPacketSphere(const RayPacket& packet, const Sphere* sphere, __m128* tmin)
+	{
+		// same operations as the scalar test, so every lane gives the same result
+		__m128 m[3];
+		for (int i = 0; i < 3; ++i)
+			m[i] = _mm_sub_ps(packet.origin[i], _mm_set1_ps(sphere->c[i]));
+
+		__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], packet.dir[0]), _mm_mul_ps(m[1], packet.dir[1])), _mm_mul_ps(m[2], packet.dir[2]));
+		__m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0], m[0]), _mm_mul_ps(m[1], m[1])), _mm_mul_ps(m[2], m[2])),
+			_mm_set1_ps(sphere->r * sphere->r));
+
+		__m128 zero = _mm_setzero_ps();
+
+		// starts outside and points away
+		__m128 miss = _mm_and_ps(_mm_cmpgt_ps(c, zero), _mm_cmpgt_ps(b, zero));
+
+		__m128 discr = _mm_sub_ps(_mm_mul_ps(b, b), c);
+		miss = _mm_or_ps(miss, _mm_cmplt_ps(discr, zero));
+
+		__m128 t = _mm_sub_ps(_mm_xor_ps(b, _mm_set1_ps(-0.0f)), _mm_sqrt_ps(_mm_max_ps(discr, zero)));
+		*tmin = _mm_max_ps(t, zero);
+
+		return ~_mm_movemask_ps(miss) & 0xf;
+	}
+
+}
@@ -3,6 +3,7 @@
 #include "Shapes.h"
 #include <float.h>
 #include <vector>
+#include <xmmintrin.h>
 
 
 namespace ong
@@ -10,27 +11,33 @@ namespace ong
 
 
 
-	void createFaceContact(FaceQuery* faceQuery, const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, float dir, ContactManifold* manifold)
+	// the face of the hull most antiparallel to the reference plane
+	static int findIncidentFace(const Plane& referencePlane, const Hull* hull, const Transform* t)
 	{
-		// find incident face
-
-
-		Plane referencePlane = transformPlane(hull1->pPlanes[faceQuery->index], *t1);
-
-		//set manifold normal
-		manifold->normal = dir * referencePlane.n;
-
 		int minIndex = -1;
 		float min = FLT_MAX;
-		for (int i = 0; i < hull2->numFaces; ++i)
+		for (int i = 0; i < hull->numFaces; ++i)
 		{
-			vec3 n = rotate(hull2->pPlanes[i].n, t2->q);
+			vec3 n = rotate(hull->pPlanes[i].n, t->q);
 
 			float d = dot(referencePlane.n, n);
 			if (d < min)
 				minIndex = i, min = d;
 		}
 
+		return minIndex;
+	}
+
+	void createFaceContact(FaceQuery* faceQuery, const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, float dir, ContactManifold* manifold)
+	{
+		Plane referencePlane = transformPlane(hull1->pPlanes[faceQuery->index], *t1);
+
+		//set manifold normal
+		manifold->normal = dir * referencePlane.n;
+
+		// find incident face
+		int minIndex = findIncidentFace(referencePlane, hull2, t2);
+
 		Face* f1 = hull1->pFaces + faceQuery->index;
 		Face* f2 = hull2->pFaces + minIndex;
 
@@ -91,12 +98,12 @@ namespace ong
 
 				if (distC * distD < 0.0f)
 				{
-					vec3 I;
-					float t;
-					intersectSegmentPlane(C->position, D.position, sidePlane, t, I);
+					// intersect with the clip distances, intersectSegmentPlane can miss
+					// a nearly touching end point by rounding and leave the point unset
+					float t = distC / (distC - distD);
 
 					ContactPoint P;
-					P.position = I;
+					P.position = C->position + t * (D.position - C->position);
 					P.penetration = 0.0f;
 
 					out->push_back(P);
@@ -181,27 +188,143 @@ namespace ong
 
 
 
+	// a cached face contact skips the face and edge directions as long as the relative transform stays within these tolerances
+	static const float FEATURE_LINEAR_TOLERANCE = 0.005f;
+	static const float FEATURE_ANGULAR_TOLERANCE = 0.99999f; // cos of half the angle
+
+	static void setFaceFeature(Feature* feature, int face1, int face2, const Transform& relative)
+	{
+		feature->type = Feature::HULL_FACE;
+		feature->hullFace.face1 = face1;
+		feature->hullFace.face2 = face2;
+		feature->relative = relative;
+	}
+
+	static void setEdgeFeature(Feature* feature, int edge1, int edge2, const Transform& relative)
+	{
+		feature->type = Feature::HULL_EDGE;
+		feature->hullEdge.edge1 = edge1;
+		feature->hullEdge.edge2 = edge2;
+		feature->relative = relative;
+	}
+
+	static bool queryCachedFeature(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, ContactManifold* manifold, Feature* feature, const Transform& relative)
+	{
+		float separation;
+		if (feature->type == Feature::HULL_FACE && feature->hullFace.face1 != -1)
+			separation = queryFaceDirection(hull1, t1, hull2, t2, feature->hullFace.face1);
+		else if (feature->type == Feature::HULL_FACE)
+			separation = queryFaceDirection(hull2, t2, hull1, t1, feature->hullFace.face2);
+		else
+			separation = queryEdgeDirection(hull1, t1, hull2, t2, feature->hullEdge.edge1, feature->hullEdge.edge2);
+
+		// the cached axis still separates the shapes
+		if (separation > 0.0f)
+			return true;
+
+		// edge contacts are transient, only face contacts are kept
+		if (feature->type != Feature::HULL_FACE)
+			return false;
+
+		// the directions are skipped only if the shapes barely moved
+		vec3 dp = relative.p - feature->relative.p;
+		float dq = dot(relative.q.v, feature->relative.q.v) + relative.q.w * feature->relative.q.w;
+		if (lengthSq(dp) > FEATURE_LINEAR_TOLERANCE * FEATURE_LINEAR_TOLERANCE || abs(dq) < FEATURE_ANGULAR_TOLERANCE)
+			return false;
+
+		// while resting only the incident face can take over as reference face,
+		// the ties are broken in favour of hull1 like in the full test
+		if (feature->hullFace.face1 != -1)
+		{
+			FaceQuery reference = { feature->hullFace.face1, separation };
+			FaceQuery incident;
+			incident.index = findIncidentFace(transformPlane(hull1->pPlanes[reference.index], *t1), hull2, t2);
+			incident.separation = queryFaceDirection(hull2, t2, hull1, t1, incident.index);
+
+			if (incident.separation > 0.0f)
+				return true;
+
+			if (reference.separation >= incident.separation)
+			{
+				createFaceContact(&reference, hull1, t1, hull2, t2, 1.0f, manifold);
+			}
+			else
+			{
+				createFaceContact(&incident, hull2, t2, hull1, t1, -1.0f, manifold);
+				feature->hullFace.face1 = -1;
+				feature->hullFace.face2 = incident.index;
+			}
+		}
+		else
+		{
+			FaceQuery reference = { feature->hullFace.face2, separation };
+			FaceQuery incident;
+			incident.index = findIncidentFace(transformPlane(hull2->pPlanes[reference.index], *t2), hull1, t1);
+			incident.separation = queryFaceDirection(hull1, t1, hull2, t2, incident.index);
+
+			if (incident.separation > 0.0f)
+				return true;
+
+			if (reference.separation > incident.separation)
+			{
+				createFaceContact(&reference, hull2, t2, hull1, t1, -1.0f, manifold);
+			}
+			else
+			{
+				createFaceContact(&incident, hull1, t1, hull2, t2, 1.0f, manifold);
+				feature->hullFace.face1 = incident.index;
+				feature->hullFace.face2 = -1;
+			}
+		}
+
+		return true;
+	}
+
 	void SAT(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, ContactManifold* manifold, Feature* feature)
 	{
 		manifold->numPoints = 0;
 
+		Transform relative = invTransformTransform(*t2, *t1);
+
+		// temporal coherence, test the feature of the last frame first
+		if (feature && feature->type != Feature::NONE)
+		{
+			if (queryCachedFeature(hull1, t1, hull2, t2, manifold, feature, relative))
+				return;
+			manifold->numPoints = 0;
+		}
+
+		// the separating axis is kept as feature as well,
+		// so it is tested first while the shapes stay apart
 		FaceQuery faceQueryA;
 		queryFaceDirections(hull1, t1, hull2, t2, &faceQueryA);
 
 		if (faceQueryA.separation > 0.0f)
+		{
+			if (feature)
+				setFaceFeature(feature, faceQueryA.index, -1, relative);
 			return;
+		}
 
 		FaceQuery faceQueryB;
 		queryFaceDirections(hull2, t2, hull1, t1, &faceQueryB);
 
 		if (faceQueryB.separation > 0.0f)
+		{
+			if (feature)
+				setFaceFeature(feature, -1, faceQueryB.index, relative);
 			return;
+		}
 
 		EdgeQuery edgeQuery;
 		queryEdgeDirections(hull1, t1, hull2, t2, &edgeQuery);
 
 		if (edgeQuery.separation > 0.0f)
+		{
+			if (feature)
+				setEdgeFeature(feature, edgeQuery.index1, edgeQuery.index2, relative);
 			return;
+		}
 
 		//dunno about this
 		edgeQuery.separation -= 0.00001f;
@@ -211,34 +334,21 @@ namespace ong
 			createFaceContact(&faceQueryA, hull1, t1, hull2, t2, 1.0f, manifold);
 
 			if (feature)
-			{
-				feature->type = Feature::HULL_FACE;
-				feature->hullFace.face1 = faceQueryA.index;
-				feature->hullFace.face2 = -1;
-			}
-
+				setFaceFeature(feature, faceQueryA.index, -1, relative);
 		}
 		else if (faceQueryB.separation >= edgeQuery.separation)
 		{
 			createFaceContact(&faceQueryB, hull2, t2, hull1, t1, -1.0f, manifold);
 
 			if (feature)
-			{
-				feature->type = Feature::HULL_FACE;
-				feature->hullFace.face2 = faceQueryB.index;
-				feature->hullFace.face1 = -1;
-			}
+				setFaceFeature(feature, -1, faceQueryB.index, relative);
 		}
 		else
 		{
 			createEdgeContact(&edgeQuery, hull1, t1, hull2, t2, manifold);
 
 			if (feature)
-			{
-				feature->type = Feature::HULL_EDGE;
-				feature->hullEdge.edge1 = edgeQuery.index1;
-				feature->hullEdge.edge1 = edgeQuery.index2;
-			}
+				setEdgeFeature(feature, edgeQuery.index1, edgeQuery.index2, relative);
 		}
 	}
 
@@ -272,6 +382,15 @@ namespace ong
 	}
 
 
+	float queryFaceDirection(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, int index)
+	{
+		Transform t = invTransformTransform(*t1, *t2);
+
+		Plane plane = transformPlane(hull1->pPlanes[index], t);
+		return project(plane, hull2);
+	}
+
+
 	bool isMinkowskiSum(const vec3& A, const vec3& B, const vec3& BxA, const vec3& C, const vec3& D, const vec3& DxC)
 	{
 		//test if arcs AB and CD intersect on unit sphere
@@ -309,7 +428,7 @@ namespace ong
 		return dot(n, P2 - P1);
 	}
 
-	void queryEdgeDirections(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, EdgeQuery* out)
+	void queryEdgeDirectionsScalar(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, EdgeQuery* out)
 	{
 		Transform t = invTransformTransform(*t1, *t2);
 
@@ -360,4 +479,182 @@ namespace ong
 
 	}
 
+	// half edge indices are stored in a byte
+	static const int MAX_HULL_EDGES = 128;
+
+	static inline __m128 dot4(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+	}
+
+	void queryEdgeDirections(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, EdgeQuery* out)
+	{
+		Transform t = invTransformTransform(*t1, *t2);
+
+		vec3 C1 = transformVec3(hull1->centroid, t);
+
+		// the edges of hull2 in SoA, negated for the minkowski difference.
+		// padding lanes have zero arcs which never pass the gauss map test
+		int numEdges2 = hull2->numEdges / 2;
+		int numPacked = (numEdges2 + 3) & ~3;
+		assert(numEdges2 <= MAX_HULL_EDGES);
+
+		float C[3][MAX_HULL_EDGES];
+		float D[3][MAX_HULL_EDGES];
+		float DxC[3][MAX_HULL_EDGES];
+		float P2[3][MAX_HULL_EDGES];
+
+		for (int i = 0; i < numPacked; ++i)
+		{
+			if (i < numEdges2)
+			{
+				HalfEdge* e2 = hull2->pEdges + 2 * i;
+				HalfEdge* et2 = hull2->pEdges + e2->twin;
+
+				const vec3& P = hull2->pVertices[e2->tail];
+				vec3 E = hull2->pVertices[et2->tail] - P;
+
+				for (int k = 0; k < 3; ++k)
+				{
+					C[k][i] = -hull2->pPlanes[e2->face].n[k];
+					D[k][i] = -hull2->pPlanes[et2->face].n[k];
+					DxC[k][i] = -E[k];
+					P2[k][i] = P[k];
+				}
+			}
+			else
+			{
+				for (int k = 0; k < 3; ++k)
+					C[k][i] = D[k][i] = DxC[k][i] = P2[k][i] = 0.0f;
+			}
+		}
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 tolerance = _mm_set1_ps(0.005f);
+
+		int maxIndex1 = -1, maxIndex2 = -1;
+		float maxSeparation = -FLT_MAX;
+
+		for (int i1 = 0; i1 < hull1->numEdges; i1 += 2)
+		{
+			HalfEdge* e1 = hull1->pEdges + i1;
+			HalfEdge* et1 = hull1->pEdges + e1->twin;
+
+			vec3 P1 = transformVec3(hull1->pVertices[e1->tail], t);
+			vec3 Q1 = transformVec3(hull1->pVertices[et1->tail], t);
+			vec3 E1 = Q1 - P1;
+
+			vec3 U1 = rotate(hull1->pPlanes[e1->face].n, t.q);
+			vec3 V1 = rotate(hull1->pPlanes[et1->face].n, t.q);
+
+			vec3 BxA = -E1;
+			vec3 PC = P1 - C1;
+
+			__m128 ax = _mm_set1_ps(U1.x), ay = _mm_set1_ps(U1.y), az = _mm_set1_ps(U1.z);
+			__m128 bx = _mm_set1_ps(V1.x), by = _mm_set1_ps(V1.y), bz = _mm_set1_ps(V1.z);
+			__m128 bax = _mm_set1_ps(BxA.x), bay = _mm_set1_ps(BxA.y), baz = _mm_set1_ps(BxA.z);
+			__m128 e1x = _mm_set1_ps(E1.x), e1y = _mm_set1_ps(E1.y), e1z = _mm_set1_ps(E1.z);
+			__m128 p1x = _mm_set1_ps(P1.x), p1y = _mm_set1_ps(P1.y), p1z = _mm_set1_ps(P1.z);
+			__m128 pcx = _mm_set1_ps(PC.x), pcy = _mm_set1_ps(PC.y), pcz = _mm_set1_ps(PC.z);
+			__m128 e1Sq = _mm_set1_ps(dot(E1, E1));
+
+			for (int i2 = 0; i2 < numPacked; i2 += 4)
+			{
+				__m128 cx = _mm_loadu_ps(C[0] + i2), cy = _mm_loadu_ps(C[1] + i2), cz = _mm_loadu_ps(C[2] + i2);
+				__m128 dx = _mm_loadu_ps(D[0] + i2), dy = _mm_loadu_ps(D[1] + i2), dz = _mm_loadu_ps(D[2] + i2);
+				__m128 dcx = _mm_loadu_ps(DxC[0] + i2), dcy = _mm_loadu_ps(DxC[1] + i2), dcz = _mm_loadu_ps(DxC[2] + i2);
+
+				// cull edge pairs whose arcs on the gauss map do not intersect
+				__m128 CBA = dot4(cx, cy, cz, bax, bay, baz);
+				__m128 DBA = dot4(dx, dy, dz, bax, bay, baz);
+				__m128 ADC = dot4(ax, ay, az, dcx, dcy, dcz);
+				__m128 BDC = dot4(bx, by, bz, dcx, dcy, dcz);
+
+				__m128 isMinkowskiFace = _mm_and_ps(
+					_mm_and_ps(_mm_cmplt_ps(_mm_mul_ps(CBA, DBA), zero), _mm_cmplt_ps(_mm_mul_ps(ADC, BDC), zero)),
+					_mm_cmpgt_ps(_mm_mul_ps(CBA, BDC), zero));
+
+				if (_mm_movemask_ps(isMinkowskiFace) == 0)
+					continue;
+
+				// distance of edge2 to the plane through edge1, same as project()
+				__m128 e2x = _mm_sub_ps(zero, dcx), e2y = _mm_sub_ps(zero, dcy), e2z = _mm_sub_ps(zero, dcz);
+
+				__m128 nx = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+				__m128 ny = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+				__m128 nz = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+
+				// skip near parallel edges
+				__m128 L = _mm_sqrt_ps(dot4(nx, ny, nz, nx, ny, nz));
+				__m128 minL = _mm_mul_ps(tolerance, _mm_sqrt_ps(_mm_mul_ps(e1Sq, dot4(e2x, e2y, e2z, e2x, e2y, e2z))));
+				int mask = _mm_movemask_ps(_mm_andnot_ps(_mm_cmplt_ps(L, minL), isMinkowskiFace));
+
+				if (mask == 0)
+					continue;
+
+				__m128 invL = _mm_div_ps(one, L);
+				nx = _mm_mul_ps(invL, nx);
+				ny = _mm_mul_ps(invL, ny);
+				nz = _mm_mul_ps(invL, nz);
+
+				// assure consistent normal orientation
+				__m128 flip = _mm_and_ps(_mm_cmplt_ps(dot4(nx, ny, nz, pcx, pcy, pcz), zero), _mm_set1_ps(-0.0f));
+				nx = _mm_xor_ps(nx, flip);
+				ny = _mm_xor_ps(ny, flip);
+				nz = _mm_xor_ps(nz, flip);
+
+				__m128 separation = dot4(nx, ny, nz,
+					_mm_sub_ps(_mm_loadu_ps(P2[0] + i2), p1x),
+					_mm_sub_ps(_mm_loadu_ps(P2[1] + i2), p1y),
+					_mm_sub_ps(_mm_loadu_ps(P2[2] + i2), p1z));
+
+				float s[4];
+				_mm_storeu_ps(s, separation);
+
+				for (int k = 0; k < 4; ++k)
+				{
+					if ((mask & (1 << k)) && s[k] > maxSeparation)
+						maxIndex1 = i1, maxIndex2 = 2 * (i2 + k), maxSeparation = s[k];
+				}
+			}
+		}
+
+		out->index1 = maxIndex1;
+		out->index2 = maxIndex2;
+		out->separation = maxSeparation;
+	}
+
+	float queryEdgeDirection(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, int index1, int index2)
+	{
+		Transform t = invTransformTransform(*t1, *t2);
+
+		vec3 C1 = transformVec3(hull1->centroid, t);
+
+		HalfEdge* e1 = hull1->pEdges + index1;
+		HalfEdge* et1 = hull1->pEdges + e1->twin;
+
+		vec3 P1 = transformVec3(hull1->pVertices[e1->tail], t);
+		vec3 Q1 = transformVec3(hull1->pVertices[et1->tail], t);
+		vec3 E1 = Q1 - P1;
+
+		vec3 U1 = rotate(hull1->pPlanes[e1->face].n, t.q);
+		vec3 V1 = rotate(hull1->pPlanes[et1->face].n, t.q);
+
+		HalfEdge* e2 = hull2->pEdges + index2;
+		HalfEdge* et2 = hull2->pEdges + e2->twin;
+
+		vec3 P2 = hull2->pVertices[e2->tail];
+		vec3 Q2 = hull2->pVertices[et2->tail];
+		vec3 E2 = Q2 - P2;
+
+		vec3 U2 = hull2->pPlanes[e2->face].n;
+		vec3 V2 = hull2->pPlanes[et2->face].n;
+
+		if (!isMinkowskiSum(U1, V1, -E1, -U2, -V2, -E2))
+			return -FLT_MAX;
+
+		return project(P1, E1, P2, E2, C1);
+	}
+
 }
\ No newline at end of file
@@ -1082,4 +1082,80 @@ namespace ong
 		return true;
 	}
 
+
+	bool intersectRayHull(const vec3& origin, const vec3& dir, const Hull* hull, float tmax)
+	{
+		float tmin = 0.0f;
+
+		for (int i = 0; i < hull->numFaces; ++i)
+		{
+			Plane& p = hull->pPlanes[i];
+
+			float denom = dot(p.n, dir);
+			float dist = distPointPlane(origin, p);
+
+			// ray parallel to face
+			if (abs(denom) < FLT_EPSILON)
+			{
+				if (dist > 0.0f)
+					return false;
+			}
+			else
+			{
+				float t = -dist / denom;
+				if (denom < 0.0f)
+				{
+					if (t > tmin) tmin = t;
+				}
+				else
+				{
+					if (t < tmax) tmax = t;
+				}
+			}
+
+			if (tmin > tmax)
+				return false;
+		}
+
+		return true;
+	}
+
+	bool intersectRaySphere(const vec3& origin, const vec3& dir, const Sphere* sphere, float tmax)
+	{
+		vec3 m = origin - sphere->c;
+		float c = dot(m, m) - sphere->r * sphere->r;
+
+		// starts inside
+		if (c <= 0.0f) return true;
+
+		float b = dot(m, dir);
+		if (b > 0.0f) return false;
+
+		float discr = b*b - c;
+		if (discr < 0.0f) return false;
+
+		return -b - sqrt(discr) <= tmax;
+	}
+
+	bool intersectRayCapsule(const vec3& origin, const vec3& dir, const Capsule* capsule, float tmax)
+	{
+		vec3 _c, r;
+		float s, t;
+		closestPtSegmentRay(capsule->c1, capsule->c2, origin, dir, s, t, _c, r);
+
+		vec3 m = origin - _c;
+		float c = dot(m, m) - capsule->r * capsule->r;
+
+		// starts inside
+		if (c <= 0.0f) return true;
+
+		float b = dot(m, dir);
+		if (b > 0.0f) return false;
+
+		float discr = b*b - c;
+		if (discr < 0.0f) return false;
+
+		return -b - sqrt(discr) <= tmax;
+	}
+
 }
\ No newline at end of file
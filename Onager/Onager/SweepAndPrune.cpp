@@ -0,0 +1,425 @@
+#include "SweepAndPrune.h"
+#include "Body.h"
+#include "Collider.h"
+
+
+namespace ong
+{
+
+	SweepAndPrune::SweepAndPrune()
+		: m_proxyIDAllocator(128 / sizeof(ProxyID))
+	{
+	}
+
+
+	// touching boxes overlap, so mins go before maxs of equal value
+	bool SweepAndPrune::less(const Endpoint& a, const Endpoint& b)
+	{
+		return a.value < b.value || (a.value == b.value && (a.data & 1) == 0 && (b.data & 1) != 0);
+	}
+
+	bool SweepAndPrune::overlap(const Box& a, const Box& b)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			if (a.aabb.c[i] - a.aabb.e[i] > b.aabb.c[i] + b.aabb.e[i] ||
+				b.aabb.c[i] - b.aabb.e[i] > a.aabb.c[i] + a.aabb.e[i])
+				return false;
+		}
+		return true;
+	}
+
+
+	const ProxyID* SweepAndPrune::addBody(Body* pBody)
+	{
+		ProxyID* id = m_proxyIDAllocator();
+		id->pBody = pBody;
+		id->level = 0;
+		updateFilter(id);
+
+		int box;
+		if (m_freeBoxes.empty())
+		{
+			box = (int)m_boxes.size();
+			m_boxes.push_back(Box());
+		}
+		else
+		{
+			box = m_freeBoxes.back();
+			m_freeBoxes.pop_back();
+		}
+
+		id->idx = box;
+
+		Box& b = m_boxes[box];
+		b.id = id;
+		b.isStatic = pBody->getType() == BodyType::Static;
+		b.aabb = calculateFatAABB(pBody->getAABB(), vec3(0.0f, 0.0f, 0.0f));
+
+		// append the endpoints and sort them in
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			Endpoint min = { b.aabb.c[axis] - b.aabb.e[axis], (uint32)box << 1 };
+			Endpoint max = { b.aabb.c[axis] + b.aabb.e[axis], ((uint32)box << 1) | 1 };
+
+			b.min[axis] = (int)m_endpoints[axis].size();
+			m_endpoints[axis].push_back(min);
+			b.max[axis] = (int)m_endpoints[axis].size();
+			m_endpoints[axis].push_back(max);
+
+			sortDown(axis, m_boxes[box].min[axis]);
+			sortDown(axis, m_boxes[box].max[axis]);
+		}
+
+		return id;
+	}
+
+	void SweepAndPrune::removeBody(const ProxyID* pProxyID)
+	{
+		int box = pProxyID->idx;
+		ProxyID* id = m_boxes[box].id;
+
+		// move the box to the end of every axis, this ends all its overlaps
+		m_boxes[box].aabb.c = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+		m_boxes[box].aabb.e = vec3(0.0f, 0.0f, 0.0f);
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_endpoints[axis][m_boxes[box].max[axis]].value = FLT_MAX;
+			m_endpoints[axis][m_boxes[box].min[axis]].value = FLT_MAX;
+
+			sortUp(axis, m_boxes[box].max[axis]);
+			sortUp(axis, m_boxes[box].min[axis]);
+
+			assert(m_boxes[box].max[axis] == (int)m_endpoints[axis].size() - 1);
+			assert(m_boxes[box].min[axis] == (int)m_endpoints[axis].size() - 2);
+
+			m_endpoints[axis].pop_back();
+			m_endpoints[axis].pop_back();
+		}
+
+		m_boxes[box].id = nullptr;
+		m_freeBoxes.push_back(box);
+
+		m_proxyIDAllocator.sDelete(id);
+	}
+
+	void SweepAndPrune::updateBody(const ProxyID* pProxyID, const vec3& displacement)
+	{
+		const AABB& aabb = pProxyID->pBody->getAABB();
+
+		int box = pProxyID->idx;
+
+		updateFilter(m_boxes[box].id);
+
+		if (contains(m_boxes[box].aabb, aabb))
+			return;
+
+		m_boxes[box].aabb = calculateFatAABB(aabb, displacement);
+		setEndpoints(box);
+	}
+
+
+	void SweepAndPrune::setEndpoints(int box)
+	{
+		const Box& b = m_boxes[box];
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			m_endpoints[axis][b.min[axis]].value = b.aabb.c[axis] - b.aabb.e[axis];
+			m_endpoints[axis][b.max[axis]].value = b.aabb.c[axis] + b.aabb.e[axis];
+
+			// the leading endpoint moves first so min and max never cross
+			sortUp(axis, b.max[axis]);
+			sortDown(axis, b.min[axis]);
+			sortUp(axis, b.min[axis]);
+			sortDown(axis, b.max[axis]);
+		}
+	}
+
+
+	void SweepAndPrune::sortDown(int axis, int index)
+	{
+		std::vector<Endpoint>& endpoints = m_endpoints[axis];
+
+		Endpoint e = endpoints[index];
+		int box = e.data >> 1;
+		bool isMax = (e.data & 1) != 0;
+
+		while (index > 0 && less(e, endpoints[index - 1]))
+		{
+			Endpoint p = endpoints[index - 1];
+			int other = p.data >> 1;
+			bool otherIsMax = (p.data & 1) != 0;
+
+			if (other != box)
+			{
+				if (!isMax && otherIsMax)
+				{
+					// min passed a max, the boxes may begin to overlap
+					if (overlap(m_boxes[box], m_boxes[other]))
+						addOverlap(box, other);
+				}
+				else if (isMax && !otherIsMax)
+				{
+					removeOverlap(box, other);
+				}
+			}
+
+			endpoints[index] = p;
+			if (otherIsMax)
+				m_boxes[other].max[axis] = index;
+			else
+				m_boxes[other].min[axis] = index;
+
+			--index;
+		}
+
+		endpoints[index] = e;
+		if (isMax)
+			m_boxes[box].max[axis] = index;
+		else
+			m_boxes[box].min[axis] = index;
+	}
+
+	void SweepAndPrune::sortUp(int axis, int index)
+	{
+		std::vector<Endpoint>& endpoints = m_endpoints[axis];
+
+		Endpoint e = endpoints[index];
+		int box = e.data >> 1;
+		bool isMax = (e.data & 1) != 0;
+
+		int last = (int)endpoints.size() - 1;
+		while (index < last && less(endpoints[index + 1], e))
+		{
+			Endpoint p = endpoints[index + 1];
+			int other = p.data >> 1;
+			bool otherIsMax = (p.data & 1) != 0;
+
+			if (other != box)
+			{
+				if (isMax && !otherIsMax)
+				{
+					// max passed a min, the boxes may begin to overlap
+					if (overlap(m_boxes[box], m_boxes[other]))
+						addOverlap(box, other);
+				}
+				else if (!isMax && otherIsMax)
+				{
+					removeOverlap(box, other);
+				}
+			}
+
+			endpoints[index] = p;
+			if (otherIsMax)
+				m_boxes[other].max[axis] = index;
+			else
+				m_boxes[other].min[axis] = index;
+
+			++index;
+		}
+
+		endpoints[index] = e;
+		if (isMax)
+			m_boxes[box].max[axis] = index;
+		else
+			m_boxes[box].min[axis] = index;
+	}
+
+
+	static inline uint64 pairKey(int a, int b)
+	{
+		if (a > b)
+			std::swap(a, b);
+		return ((uint64)a << 32) | (uint64)b;
+	}
+
+	void SweepAndPrune::addOverlap(int a, int b)
+	{
+		if (m_boxes[a].isStatic && m_boxes[b].isStatic)
+			return;
+
+		uint64 key = pairKey(a, b);
+		if (m_overlapIndex.find(key) != m_overlapIndex.end())
+			return;
+
+		m_overlapIndex[key] = (int)m_overlaps.size();
+		m_overlaps.push_back(key);
+	}
+
+	void SweepAndPrune::removeOverlap(int a, int b)
+	{
+		uint64 key = pairKey(a, b);
+
+		std::unordered_map<uint64, int>::iterator it = m_overlapIndex.find(key);
+		if (it == m_overlapIndex.end())
+			return;
+
+		int index = it->second;
+		m_overlapIndex.erase(it);
+
+		if (index != (int)m_overlaps.size() - 1)
+		{
+			m_overlaps[index] = m_overlaps.back();
+			m_overlapIndex[m_overlaps[index]] = index;
+		}
+		m_overlaps.pop_back();
+	}
+
+
+	int SweepAndPrune::generatePairs(std::vector<Pair>* pairs, JobSystem* /*jobSystem*/)
+	{
+		size_t start = pairs->size();
+
+		for (int i = 0; i < (int)m_overlaps.size(); ++i)
+		{
+			const ProxyID* idA = m_boxes[(int)(m_overlaps[i] >> 32)].id;
+			const ProxyID* idB = m_boxes[(int)(m_overlaps[i] & 0xffffffff)].id;
+
+			if (isFiltered(idA, idB))
+				continue;
+
+			Body* a = idA->pBody;
+			Body* b = idB->pBody;
+
+			// static and sleeping bodies do not collide with each other
+			if (!a->isActive() && !b->isActive())
+				continue;
+
+			if (ong::overlap(&a->getAABB(), &b->getAABB()))
+				pairs->push_back(Pair{ a, b });
+		}
+
+		return (int)(pairs->size() - start);
+	}
+
+
+	bool SweepAndPrune::queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax)
+	{
+		RayQueryResult minResult;
+		minResult.collider = 0;
+		minResult.t = tmax;
+
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr)
+				continue;
+
+			float tmin;
+			vec3 p;
+			if (!intersectRayAABB(origin, dir, m_boxes[i].aabb, tmin, p) || tmin > minResult.t)
+				continue;
+
+			RayQueryResult result = { 0 };
+			if (m_boxes[i].id->pBody->queryRay(origin, dir, &result, minResult.t) && result.t < minResult.t)
+				minResult = result;
+		}
+
+		if (minResult.collider == 0)
+			return false;
+
+		*hit = minResult;
+		return true;
+	}
+
+
+	bool SweepAndPrune::queryOcclusion(const vec3& origin, const vec3& dir, float tmax)
+	{
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr)
+				continue;
+
+			float tmin;
+			vec3 p;
+			if (!intersectRayAABB(origin, dir, m_boxes[i].aabb, tmin, p) || tmin > tmax)
+				continue;
+
+			if (m_boxes[i].id->pBody->queryOcclusion(origin, dir, tmax))
+				return true;
+		}
+
+		return false;
+	}
+
+
+	bool SweepAndPrune::queryCollider(const Collider* collider)
+	{
+		AABB aabb = calculateColliderAABB(collider);
+
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr || !ong::overlap(&m_boxes[i].aabb, &aabb))
+				continue;
+
+			Body* body = m_boxes[i].id->pBody;
+
+			if (collider->getBody() == body)
+				continue;
+			if (body->queryCollider(collider))
+				return true;
+		}
+
+		return false;
+	}
+
+	bool SweepAndPrune::queryCollider(Collider* collider, ColliderQueryCallBack callback)
+	{
+		AABB aabb = calculateColliderAABB(collider);
+
+		bool hit = false;
+
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr || !ong::overlap(&m_boxes[i].aabb, &aabb))
+				continue;
+
+			Body* body = m_boxes[i].id->pBody;
+
+			if (collider->getBody() == body)
+				continue;
+			if (!body->queryCollider(collider, callback))
+				return true;
+			else hit = true;
+		}
+
+		return hit;
+	}
+
+	bool SweepAndPrune::queryShape(ShapePtr shape, const Transform& transform)
+	{
+		AABB aabb = calculateAABB(shape, transform);
+
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr || !ong::overlap(&m_boxes[i].aabb, &aabb))
+				continue;
+
+			if (m_boxes[i].id->pBody->queryShape(shape, transform))
+				return true;
+		}
+
+		return false;
+	}
+
+	bool SweepAndPrune::queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData)
+	{
+		AABB aabb = calculateAABB(shape, transform);
+
+		bool hit = false;
+
+		for (int i = 0; i < (int)m_boxes.size(); ++i)
+		{
+			if (m_boxes[i].id == nullptr || !ong::overlap(&m_boxes[i].aabb, &aabb))
+				continue;
+
+			if (!m_boxes[i].id->pBody->queryShape(shape, transform, callback, userData))
+				return true;
+			else hit = true;
+		}
+
+		return hit;
+	}
+
+}
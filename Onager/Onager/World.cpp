@@ -1,8 +1,11 @@
 #include "World.h"
 #include "Narrowphase.h"
 #include "ContactSolver.h"
+#include "ContactSolverSIMD.h"
 #include "QuickHull.h"
 #include "Profiler.h"
+#include "Island.h"
+#include "Settings.h"
 
 
 namespace ong
@@ -10,8 +13,31 @@ namespace ong
 
 
 
+	static WorldSettings settingsWithGravity(const vec3& gravity)
+	{
+		WorldSettings settings;
+		settings.gravity = gravity;
+		return settings;
+	}
+
+
 	World::World(const vec3& gravity)
-		: m_gravity(gravity),
+		: World(settingsWithGravity(gravity))
+	{
+	}
+
+
+	World::World(const WorldSettings& settings)
+		: m_gravity(settings.gravity),
+		m_solverMode(settings.solverMode),
+		m_minIterations(settings.minIterations),
+		m_maxIterations(settings.maxIterations),
+		m_impulseTolerance(settings.impulseTolerance),
+		m_solverIterations(0),
+		m_broadphaseType(settings.broadphase),
+		m_frameAllocator(settings.frameMemorySize),
+		m_jobSystem(settings.numThreads),
+		m_islandTick(0),
 		m_bodyAllocator(BodyAllocator(32)),
 		m_colliderAllocator(ColliderAllocator(32)),
 		m_hullAllocator(HullAllocator(32)),
@@ -23,6 +49,22 @@ namespace ong
 		m_numColliders(0)
 
 	{
+		assert(settings.minIterations >= 1 && settings.minIterations <= settings.maxIterations);
+
+		if (settings.broadphase == BroadphaseType::AABB_TREE)
+			m_broadphase = new AABBTree();
+		else if (settings.broadphase == BroadphaseType::SWEEP_AND_PRUNE)
+			m_broadphase = new SweepAndPrune();
+		else
+			m_broadphase = new HGrid(settings.hgridNumCells, settings.hgridMaxLoadFactor);
+
+		m_contactManager.setPairManager(&m_broadphase->getPairManager());
+	}
+
+
+	World::~World()
+	{
+		delete m_broadphase;
 	}
 
 
@@ -31,50 +73,81 @@ namespace ong
 
 		assert(dt != 0.0f);
 
+		m_frameAllocator.reset();
+
+		// static bodies only update their proxy when they are moved
+		m_jobSystem.parallelFor(m_numBodies, BODY_GRAIN_SIZE, [this](int begin, int end, int)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				if (m_b[i]->isActive())
+					m_b[i]->calculateAABB();
+			}
+		});
 
 		Body* b = m_pBody;
 		while (b != nullptr)
 		{
-			b->calculateAABB();
-			m_hGrid.updateBody(b->getProxyID());
-			//b->clearContacts();
+			if (b->isActive())
+				m_broadphase->updateBody(b->getProxyID(), dt * m_v[b->getIndex()].v);
 			b = b->getNext();
 		}
 
 
 		// broadphase
 		ong_START_PROFILE(BROADPHASE);
-		Pair* pairs = new Pair[m_numBodies * m_numBodies];
-		int numPairs = 0;
-		numPairs = m_hGrid.generatePairs(pairs);
+		int numPairs = m_broadphase->updatePairs(&m_jobSystem);
 
 		ong_END_PROFILE(BROADPHASE);
-		assert(numPairs <= m_numBodies*m_numBodies);
 
 		//narrowphase
 		ong_START_PROFILE(NARROWPHASE);
 		//todo ...
 		//m_contactManager.generateContacts(pairs, numPairs, m_numColliders*m_numColliders);
 
-		m_contactManager.generateContacts(pairs, numPairs, 3 * numPairs);
+		m_contactManager.generateContacts(m_broadphase->getPairs(), m_broadphase->getPairIDs(), numPairs, 3 * numPairs, &m_jobSystem);
 		
 		ong_END_PROFILE(NARROWPHASE);
 
+		//islands, wakes up sleeping bodies touched by awake ones
+		ong_START_PROFILE(ISLANDS);
+		int numContacts = 0;
+		Contact** contacts = m_contactManager.getContacts(&numContacts);
+
+		IslandSet islands;
+		buildIslands(m_b.data(), m_numBodies, numContacts, ++m_islandTick, &m_frameAllocator, &islands);
+
+		// only solve contacts with an awake body, keep the contact order
+		Contact** awakeContacts = m_frameAllocator.allocate<Contact*>(numContacts);
+		int numAwakeContacts = 0;
+		for (int i = 0; i < numContacts; ++i)
+		{
+			if (contacts[i]->colliderA->getBody()->isActive() || contacts[i]->colliderB->getBody()->isActive())
+				awakeContacts[numAwakeContacts++] = contacts[i];
+		}
+		ong_END_PROFILE(ISLANDS);
+
 		//integrate
 		ong_START_PROFILE(INTEGRATE);
 
-		for (int i = 0; i < m_numBodies; ++i)
+		m_jobSystem.parallelFor(m_numBodies, BODY_GRAIN_SIZE, [this, dt](int begin, int end, int)
 		{
-			mat3x3 q = toRotMat(m_r[i].q);
+			for (int i = begin; i < end; ++i)
+			{
+				if (m_b[i]->isSleeping())
+					continue;
 
-			m_m[i].invI = q * m_m[i].localInvI * transpose(q);
+				mat3x3 q = toRotMat(m_r[i].q);
 
-			if (m_m[i].invM != 0.0f)
-				m_p[i].l += dt * 1.0f / m_m[i].invM * m_gravity;
+				m_m[i].invI = q * m_m[i].localInvI * transpose(q);
 
-			m_v[i].v = m_m[i].invM * m_p[i].l;
-			m_v[i].w = m_m[i].invI* m_p[i].a;
-		}
+				if (m_m[i].invM != 0.0f)
+					m_p[i].l += dt * 1.0f / m_m[i].invM * m_gravity;
+
+				m_v[i].v = m_m[i].invM * m_p[i].l;
+				m_v[i].w = m_m[i].invI* m_p[i].a;
+			}
+		});
 
 		ong_END_PROFILE(INTEGRATE);
 
@@ -87,45 +160,185 @@ namespace ong
 			context.p = m_p.data();
 			context.m = m_m.data();
 
-			int numContacts = 0;
-			Contact** c = m_contactManager.getContacts(&numContacts);
-
-			ContactConstraint* contactConstraints = new ContactConstraint[numContacts];
-			preSolveContacts(&context, c, numContacts, 1.0f / dt, contactConstraints);
-
-			for (int i = 0; i < 16; ++i)
+			if (m_solverMode == SolverMode::ISLANDS)
 			{
-				solveContacts(&context, c, numContacts, contactConstraints);
+				solveIslands(&context, &islands, dt);
 			}
+			else if (m_solverMode == SolverMode::SIMD)
+			{
+				solveBatches(&context, awakeContacts, numAwakeContacts, dt);
+			}
+			else
+			{
+				ContactConstraint* contactConstraints = m_frameAllocator.allocate<ContactConstraint>(numAwakeContacts);
+				preSolveContacts(&context, awakeContacts, numAwakeContacts, 1.0f / dt, contactConstraints);
 
-			postSolveContacts(&context, c, numContacts, contactConstraints);
+				m_solverIterations = solveSequential(&context, contactConstraints, numAwakeContacts);
 
-			//for (int i = 0; i < numContacts; ++i)
-			//{
-			//	c[i]->colliderA->callbackPostSolve(c[i]);
-			//	c[i]->colliderB->callbackPostSolve(c[i]);
-			//}
+				postSolveContacts(&context, awakeContacts, numAwakeContacts, contactConstraints);
+			}
 
-			delete[] contactConstraints;
+			// callbacks stay on the calling thread
+			for (int i = 0; i < numAwakeContacts; ++i)
+			{
+				awakeContacts[i]->colliderA->callbackPostSolve(awakeContacts[i]);
+				awakeContacts[i]->colliderB->callbackPostSolve(awakeContacts[i]);
+			}
 		}
 		ong_END_PROFILE(RESOLUTION);
 
 		ong_START_PROFILE(INTEGRATE2);
-		for (int i = 0; i < m_numBodies; ++i)
+		m_jobSystem.parallelFor(m_numBodies, BODY_GRAIN_SIZE, [this, dt](int begin, int end, int)
 		{
-			m_r[i].p += dt * m_v[i].v;
+			for (int i = begin; i < end; ++i)
+			{
+				if (m_b[i]->isSleeping())
+					continue;
 
-			vec3 wAxis = dt * m_v[i].w;
-			float wScalar = sqrt(lengthSq(wAxis));
-			
-			wScalar = ong_MAX(-0.25f*ong_PI, ong_MIN(0.25f*ong_PI, wScalar));
+				m_r[i].p += dt * m_v[i].v;
 
-			if (wScalar != 0.0f)
-				m_r[i].q = QuatFromAxisAngle(1.0f / wScalar * wAxis, wScalar) * m_r[i].q;
-		}
+				vec3 wAxis = dt * m_v[i].w;
+				float wScalar = sqrt(lengthSq(wAxis));
+
+				wScalar = ong_MAX(-0.25f*ong_PI, ong_MIN(0.25f*ong_PI, wScalar));
+
+				if (wScalar != 0.0f)
+					m_r[i].q = QuatFromAxisAngle(1.0f / wScalar * wAxis, wScalar) * m_r[i].q;
+			}
+		});
 		ong_END_PROFILE(INTEGRATE2);
 
-		delete[] pairs;
+		ong_START_PROFILE(SLEEP);
+		updateSleeping(&islands, dt);
+		ong_END_PROFILE(SLEEP);
+	}
+
+
+	int World::solveSequential(WorldContext* context, ContactConstraint* constraints, int numConstraints)
+	{
+		int iterations = 0;
+		while (iterations < m_maxIterations)
+		{
+			float maxDelta = solveContacts(context, constraints, numConstraints);
+			++iterations;
+
+			if (iterations >= m_minIterations && maxDelta <= m_impulseTolerance)
+				break;
+		}
+
+		return iterations;
+	}
+
+
+	void World::solveIslands(WorldContext* context, const IslandSet* islands, float dt)
+	{
+		ContactConstraint* contactConstraints = m_frameAllocator.allocate<ContactConstraint>(islands->numContacts);
+		int* islandIterations = m_frameAllocator.allocate<int>(islands->numIslands);
+
+		// islands share no awake bodies, each one is solved by a single job
+		m_jobSystem.parallelFor(islands->numIslands, 1, [=](int begin, int end, int)
+		{
+			for (int i = begin; i < end; ++i)
+			{
+				const Island& island = islands->islands[i];
+
+				islandIterations[i] = 0;
+				if (island.numContacts == 0)
+					continue;
+
+				Contact** contacts = islands->contacts + island.contactStart;
+				ContactConstraint* constraints = contactConstraints + island.contactStart;
+
+				preSolveContacts(context, contacts, island.numContacts, 1.0f / dt, constraints);
+
+				islandIterations[i] = solveSequential(context, constraints, island.numContacts);
+
+				postSolveContacts(context, contacts, island.numContacts, constraints);
+			}
+		});
+
+		m_solverIterations = 0;
+		for (int i = 0; i < islands->numIslands; ++i)
+			m_solverIterations = ong_MAX(m_solverIterations, islandIterations[i]);
+	}
+
+
+	void World::solveBatches(WorldContext* context, Contact** contacts, int numContacts, float dt)
+	{
+		ContactConstraint* contactConstraints = m_frameAllocator.allocate<ContactConstraint>(numContacts);
+		preSolveContacts(context, contacts, numContacts, 1.0f / dt, contactConstraints);
+
+		ContactBatches batches;
+		prepareContactBatches(context, contactConstraints, numContacts, m_numBodies, &m_frameAllocator, &batches);
+
+		// largest impulse change per thread
+		int numThreads = m_jobSystem.getNumThreads();
+		float* threadDelta = m_frameAllocator.allocate<float>(numThreads);
+
+		m_solverIterations = 0;
+		while (m_solverIterations < m_maxIterations)
+		{
+			for (int i = 0; i < numThreads; ++i)
+				threadDelta[i] = 0.0f;
+
+			// batches of one color share no awake bodies
+			for (int color = 0; color < batches.numColors; ++color)
+			{
+				ContactBatch* colorBatches = batches.batches + batches.colorStart[color];
+				int numColorBatches = batches.colorStart[color + 1] - batches.colorStart[color];
+
+				m_jobSystem.parallelFor(numColorBatches, BATCH_GRAIN_SIZE, [=](int begin, int end, int thread)
+				{
+					float delta = solveContactBatches(context, colorBatches + begin, end - begin);
+					threadDelta[thread] = ong_MAX(threadDelta[thread], delta);
+				});
+			}
+
+			float maxDelta = solveContacts(context, batches.overflow, batches.numOverflow);
+			for (int i = 0; i < numThreads; ++i)
+				maxDelta = ong_MAX(maxDelta, threadDelta[i]);
+
+			++m_solverIterations;
+			if (m_solverIterations >= m_minIterations && maxDelta <= m_impulseTolerance)
+				break;
+		}
+
+		finishContactBatches(&batches);
+
+		postSolveContacts(context, contacts, numContacts, contactConstraints);
+	}
+
+
+	void World::updateSleeping(const IslandSet* islands, float dt)
+	{
+		const float linTolSq = ong_LINEAR_SLEEP_TOLERANCE * ong_LINEAR_SLEEP_TOLERANCE;
+		const float angTolSq = ong_ANGULAR_SLEEP_TOLERANCE * ong_ANGULAR_SLEEP_TOLERANCE;
+
+		for (int i = 0; i < islands->numIslands; ++i)
+		{
+			const Island& island = islands->islands[i];
+			Body** bodies = islands->bodies + island.bodyStart;
+
+			float minSleepTime = FLT_MAX;
+
+			for (int j = 0; j < island.numBodies; ++j)
+			{
+				int idx = bodies[j]->getIndex();
+
+				if (lengthSq(m_v[idx].v) > linTolSq || lengthSq(m_v[idx].w) > angTolSq)
+					bodies[j]->setSleepTime(0.0f);
+				else
+					bodies[j]->setSleepTime(bodies[j]->getSleepTime() + dt);
+
+				minSleepTime = ong_MIN(minSleepTime, bodies[j]->getSleepTime());
+			}
+
+			if (minSleepTime >= ong_TIME_TO_SLEEP)
+			{
+				for (int j = 0; j < island.numBodies; ++j)
+					bodies[j]->sleep();
+			}
+		}
 	}
 
 	Body* World::createBody(const BodyDescription& description)
@@ -144,7 +357,7 @@ namespace ong
 		body->setNext(m_pBody);
 		body->setPrevious(nullptr);
 
-		const ProxyID* proxyID = m_hGrid.addBody(body);
+		const ProxyID* proxyID = m_broadphase->addBody(body);
 		
 		body->setProxyID(proxyID);
 
@@ -162,9 +375,23 @@ namespace ong
 
 	void World::destroyBody(Body* pBody)
 	{
+		m_contactManager.removeBody(pBody);
+		m_broadphase->getPairManager().removeBody(pBody);
 
+		freeBody(pBody);
+	}
 
+	void World::destroyBodies(Body* const* bodies, int numBodies)
+	{
+		m_contactManager.removeBodies(bodies, numBodies);
+		m_broadphase->getPairManager().removeBodies(bodies, numBodies);
 
+		for (int i = 0; i < numBodies; ++i)
+			freeBody(bodies[i]);
+	}
+
+	void World::freeBody(Body* pBody)
+	{
 		int idx = pBody->getIndex();
 
 		m_numBodies--;
@@ -185,16 +412,14 @@ namespace ong
 		m_b.pop_back();
 
 
-
-
-		m_contactManager.removeBody(pBody);
-
-
+		// the body goes away, no need to update it for every removed collider
 		Collider* c = pBody->getCollider();
 		while (c)
 		{
+			Collider* next = c->getNext();
+			c->setBody(nullptr);
 			destroyCollider(c);
-			c = c->getNext();
+			c = next;
 		}
 
 		if (pBody->getPrevious())
@@ -205,7 +430,7 @@ namespace ong
 		if (m_pBody == pBody)
 			m_pBody = pBody->getNext();
 
-		m_hGrid.removeBody(pBody->getProxyID());
+		m_broadphase->removeBody(pBody->getProxyID());
 
 
 		m_bodyAllocator.sDelete(pBody);
@@ -340,36 +565,51 @@ namespace ong
 	{
 		//Profiler profile("Query Ray");
 
-		return m_hGrid.queryRay(origin, dir, hit, tmax);
+		return m_broadphase->queryRay(origin, dir, hit, tmax);
+	}
+
+	int World::queryRays(const Ray* rays, int n, RayQueryResult* hits)
+	{
+		return m_broadphase->queryRays(rays, n, hits, &m_jobSystem);
+	}
+
+	bool World::queryOcclusion(const vec3& origin, const vec3& dir, float tmax)
+	{
+		return m_broadphase->queryOcclusion(origin, dir, tmax);
 	}
 
 	bool World::queryCollider(const Collider* collider)
 	{
-		return m_hGrid.queryCollider(collider);
+		return m_broadphase->queryCollider(collider);
 	}
 
 	bool World::queryCollider(Collider* collider, ColliderQueryCallBack callback)
 	{
-		return m_hGrid.queryCollider(collider, callback);
+		return m_broadphase->queryCollider(collider, callback);
 	}
 
 	bool World::queryShape(ShapePtr shape, const Transform& transform)
 	{
-		return m_hGrid.queryShape(shape, transform);
+		return m_broadphase->queryShape(shape, transform);
 	}
 
 	bool World::queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData)
 	{
-		return m_hGrid.queryShape(shape, transform, callback, userData);
+		return m_broadphase->queryShape(shape, transform, callback, userData);
 	}
 
 	void World::updateProxy(const ProxyID* proxyID)
 	{
-		m_hGrid.updateBody(proxyID);
+		m_broadphase->updateBody(proxyID);
 	}
 
 	void World::removeContact(Contact* pContact)
 	{
 		m_contactManager.removeContact(pContact);
 	}
+
+	void World::removeCollider(Collider* pCollider)
+	{
+		m_contactManager.removeCollider(pCollider);
+	}
 }
\ No newline at end of file
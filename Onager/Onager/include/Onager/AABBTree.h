@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Broadphase.h"
+
+
+namespace ong
+{
+
+	// dynamic bounding volume tree,
+	// leaves hold the enlarged AABB of a body and are inserted with the surface area heuristic,
+	// the tree is kept balanced with rotations.
+	// like the HGrid static bodies live in their own tree.
+	class AABBTree : public Broadphase
+	{
+	public:
+		AABBTree();
+
+		const ProxyID* addBody(Body* pBody);
+		void removeBody(const ProxyID* pProxyID);
+
+		void updateBody(const ProxyID* pProxyID, const vec3& displacement = vec3(0.0f, 0.0f, 0.0f));
+
+		int generatePairs(std::vector<Pair>* pairs, JobSystem* jobSystem = nullptr);
+
+		bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX);
+		bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX);
+		bool queryCollider(const Collider* collider);
+		bool queryCollider(Collider* collider, ColliderQueryCallBack callback);
+		bool queryShape(ShapePtr shape, const Transform& transform);
+		bool queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData);
+
+	private:
+		static const int NULL_NODE = -1;
+
+		struct Node
+		{
+			AABB aabb;
+
+			union
+			{
+				int parent;
+				int next; // free list
+			};
+
+			int left;
+			int right;
+
+			// leaves have height 0, free nodes -1
+			int height;
+
+			ProxyID* id;
+		};
+
+		struct Tree
+		{
+			Tree();
+
+			int root;
+			int freeList;
+			std::vector<Node> nodes;
+		};
+
+		Tree& getTree(const ProxyID* id);
+
+		int allocateNode(Tree& tree);
+		void freeNode(Tree& tree, int node);
+
+		void insertLeaf(Tree& tree, int leaf);
+		void removeLeaf(Tree& tree, int leaf);
+		int balance(Tree& tree, int node);
+
+		// pushes all leaves overlapping the aabb on m_result
+		void queryAABB(const Tree& tree, const AABB& aabb);
+
+		bool queryRay(const Tree& tree, const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax);
+		bool queryOcclusion(const Tree& tree, const vec3& origin, const vec3& dir, float tmax);
+
+		Tree m_dynamic;
+		Tree m_static;
+
+		// traversal scratch
+		std::vector<int> m_stack;
+		std::vector<int> m_result;
+
+		Allocator<ProxyID> m_proxyIDAllocator;
+	};
+
+}
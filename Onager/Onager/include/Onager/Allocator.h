@@ -1,5 +1,8 @@
 #pragma once
 
+#include "defines.h"
+#include <stdlib.h>
+
 namespace ong
 {
 
@@ -79,4 +82,130 @@ namespace ong
 
 	};
 
+
+	// linear allocator for per frame scratch memory, all allocations are
+	// released at once by reset().
+	// if the preallocated block runs out, overflow blocks are taken from the heap
+	// and the block is grown to the high water mark on the next reset.
+	class LinearAllocator
+	{
+	public:
+		static const size_t ALIGNMENT = 16;
+
+		LinearAllocator(size_t size)
+			: m_pBlock(nullptr),
+			m_pMemory(nullptr),
+			m_size(0),
+			m_top(0),
+			m_pOverflow(nullptr),
+			m_numOverflow(0),
+			m_overflowSize(0),
+			m_highWaterMark(0)
+		{
+			grow(size);
+		}
+
+		~LinearAllocator()
+		{
+			freeOverflow();
+			free(m_pBlock);
+		}
+
+		void* allocate(size_t size)
+		{
+			size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+			void* p;
+			if (m_top + size <= m_size)
+			{
+				p = m_pMemory + m_top;
+				m_top += size;
+			}
+			else
+			{
+				void* pBlock = malloc(size + ALIGNMENT);
+				m_pOverflow = (void**)realloc(m_pOverflow, (++m_numOverflow) * sizeof(void*));
+				m_pOverflow[m_numOverflow - 1] = pBlock;
+				m_overflowSize += size;
+
+				p = align(pBlock);
+			}
+
+			if (m_top + m_overflowSize > m_highWaterMark)
+				m_highWaterMark = m_top + m_overflowSize;
+
+			return p;
+		}
+
+		template<typename T>
+		T* allocate(int n)
+		{
+			return (T*)allocate(n * sizeof(T));
+		}
+
+		void reset()
+		{
+			if (m_numOverflow > 0)
+			{
+				freeOverflow();
+				grow(m_highWaterMark);
+			}
+			m_top = 0;
+		}
+
+		size_t getSize() const
+		{
+			return m_size;
+		}
+
+		size_t getHighWaterMark() const
+		{
+			return m_highWaterMark;
+		}
+
+	private:
+		LinearAllocator(const LinearAllocator&);
+		LinearAllocator& operator=(const LinearAllocator&);
+
+		void grow(size_t size)
+		{
+			size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+			if (size <= m_size)
+				return;
+
+			free(m_pBlock);
+			m_pBlock = malloc(size + ALIGNMENT);
+			m_pMemory = (uint8*)align(m_pBlock);
+			m_size = size;
+		}
+
+		// malloc only guarantees 8 byte alignment on 32 bit
+		static void* align(void* p)
+		{
+			return (uint8*)p + (ALIGNMENT - ((size_t)p & (ALIGNMENT - 1)));
+		}
+
+		void freeOverflow()
+		{
+			for (size_t i = 0; i < m_numOverflow; ++i)
+				free(m_pOverflow[i]);
+			free(m_pOverflow);
+
+			m_pOverflow = nullptr;
+			m_numOverflow = 0;
+			m_overflowSize = 0;
+		}
+
+		void* m_pBlock;
+		uint8* m_pMemory;
+		size_t m_size;
+		size_t m_top;
+
+		void** m_pOverflow;
+		size_t m_numOverflow;
+		size_t m_overflowSize;
+
+		size_t m_highWaterMark;
+	};
+
 }
\ No newline at end of file
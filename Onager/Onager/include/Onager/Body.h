@@ -39,6 +39,13 @@ namespace ong
 	};
 
 
+	struct Ray
+	{
+		vec3 origin;
+		vec3 dir;
+		float tmax;
+	};
+
 	struct RayQueryResult
 	{
 		Collider* collider;
@@ -85,9 +92,17 @@ namespace ong
 		void setLinearMomentum(const vec3& momentum);
 		void setAngularMomentum(const vec3& momentum);
 
+		void wakeUp();
+
 		//	--ACCESORS--
 
 		bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX);
+		// casts a packet of up to four rays, only the lanes in mask are tested.
+		// a lane hits if it finds a collider before its tmax, then its hit and tmax are updated.
+		// returns a bit per lane that hit
+		int queryRays(const Ray* rays, int count, int mask, RayQueryResult* hits, float* tmax);
+		// true if the ray hits any collider before tmax
+		bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX);
 		bool queryCollider(const Collider* collider);
 		bool queryCollider(Collider* collider, ColliderQueryCallBack callback);
 		bool queryShape(ShapePtr shape, const Transform& transform);
@@ -126,6 +141,8 @@ namespace ong
 
 		BodyType::Type getType();
 
+		bool isSleeping();
+
 		int getNumContacts();
 		ContactIter* getContacts();
 
@@ -145,9 +162,13 @@ namespace ong
 
 		void setIndex(int idx);
 
+		// puts the body to sleep and clears its velocity
+		void sleep();
+		void setSleepTime(float sleepTime);
+
 		void clearContacts();
 		void addContact(ContactIter* iter);
-		ContactIter* removeContact(Contact* contact);
+		void removeContact(ContactIter* iter);
 
 		void setProxyID(const ProxyID* proxyID);
 		const ProxyID* getProxyID();
@@ -155,16 +176,29 @@ namespace ong
 
 		void calculateTree();
 
+		// combines the collision masks of all colliders
+		void calculateCollisionFilter();
+
 		//	--ACCESSORS--
 
 		int getIndex();
 
+		// group bits all colliders belong to and filter bits all colliders filter,
+		// two bodies can not collide if one's group hits the other's filter
+		uint32 getCollisionGroup();
+		uint32 getCollisionFilter();
+
+		// dynamic and not sleeping
+		bool isActive();
+		float getSleepTime();
+
 	private:
 		enum
 		{
 			DYNAMIC = 1,
 			STATIC = 2,
 			TYPE = DYNAMIC + STATIC,
+			SLEEPING = 4,
 		};
 
 		World* m_pWorld;
@@ -173,6 +207,8 @@ namespace ong
 
 		int m_flags;
 
+		float m_sleepTime;
+
 		vec3 m_cm;
 
 		int m_numCollider;
@@ -185,6 +221,9 @@ namespace ong
 		const ProxyID* m_proxyID;
 		AABB m_aabb;
 
+		uint32 m_collisionGroup;
+		uint32 m_collisionFilter;
+
 		void* m_pUserData;
 
 		Body* m_pNext;
@@ -267,12 +306,42 @@ namespace ong
 		return m_proxyID;
 	}
 
+	inline uint32 Body::getCollisionGroup()
+	{
+		return m_collisionGroup;
+	}
+
+	inline uint32 Body::getCollisionFilter()
+	{
+		return m_collisionFilter;
+	}
+
 
 	inline BodyType::Type Body::getType()
 	{
 		return (BodyType::Type)(m_flags & TYPE);
 	}
 
+	inline bool Body::isSleeping()
+	{
+		return (m_flags & SLEEPING) != 0;
+	}
+
+	inline bool Body::isActive()
+	{
+		return (m_flags & (DYNAMIC | SLEEPING)) == DYNAMIC;
+	}
+
+	inline float Body::getSleepTime()
+	{
+		return m_sleepTime;
+	}
+
+	inline void Body::setSleepTime(float sleepTime)
+	{
+		m_sleepTime = sleepTime;
+	}
+
 	inline int Body::getNumContacts()
 	{
 		return  m_numContacts;
@@ -4,11 +4,14 @@
 #include "Shapes.h"
 #include <vector>
 #include "Allocator.h"
+#include "PairManager.h"
 
 namespace ong
 {
 	class Body;
 	class Collider;
+	class JobSystem;
+	struct Ray;
 	struct RayQueryResult;
 
 
@@ -21,92 +24,286 @@ namespace ong
 	struct ProxyID
 	{
 		Body* pBody;
+		// the HGrid stores the object's level and index,
+		// the AABBTree its leaf and sweep and prune its box in idx
 		int level;
-		int bucket;
 		int idx;
+		// combined collision masks of the body's colliders
+		uint32 collisionGroup;
+		uint32 collisionFilter;
 	};
 
-	class HGrid
+
+	struct BroadphaseType
+	{
+		enum Type
+		{
+			// hierarchical hash grid, best for many similar sized objects
+			HGRID,
+			// dynamic bounding volume tree, independent of object sizes and counts
+			AABB_TREE,
+			// incremental sweep and prune, best for coherent motion
+			SWEEP_AND_PRUNE,
+		};
+	};
+
+
+	class Broadphase
+	{
+	public:
+		virtual ~Broadphase() {}
+
+		virtual const ProxyID* addBody(Body* pBody) = 0;
+		virtual void removeBody(const ProxyID* pProxyID) = 0;
+
+		// displacement is the expected movement until the next update,
+		// the proxy is only moved if the body left its enlarged bounds
+		virtual void updateBody(const ProxyID* pProxyID, const vec3& displacement = vec3(0.0f, 0.0f, 0.0f)) = 0;
+
+		// appends all overlapping pairs, returns number of new pairs.
+		// backends may search in parallel on the job system, 
+		// the order of the pairs does not depend on the number of threads
+		virtual int generatePairs(std::vector<Pair>* pairs, JobSystem* jobSystem = nullptr) = 0;
+
+		// generates the pairs of this step and updates the persistent pairs,
+		// returns the number of pairs
+		int updatePairs(JobSystem* jobSystem = nullptr);
+
+		// pairs of the last update and their persistent ids
+		const Pair* getPairs() const;
+		const int* getPairIDs() const;
+
+		PairManager& getPairManager();
+
+		// the queries may use scratch state of the broadphase,
+		// only one query may run at a time and not during an update
+		virtual bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX) = 0;
+		// casts n rays, hits without collider are misses, returns the number of hits.
+		// backends may cast them in parallel on the job system
+		virtual int queryRays(const Ray* rays, int n, RayQueryResult* hits, JobSystem* jobSystem = nullptr);
+		// true if the ray hits anything before tmax, stops at the first hit
+		virtual bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX) = 0;
+		virtual bool queryCollider(const Collider* collider) = 0;
+		virtual bool queryCollider(Collider* collider, ColliderQueryCallBack callback) = 0;
+		virtual bool queryShape(ShapePtr shape, const Transform& transform) = 0;
+		virtual bool queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData) = 0;
+
+	protected:
+		static AABB calculateFatAABB(const AABB& aabb, const vec3& displacement);
+		// world space bounds of the collider, colliders without a body use their local bounds
+		static AABB calculateColliderAABB(const Collider* collider);
+		static bool contains(const AABB& outer, const AABB& inner);
+
+		// copies the collision masks of the body into the proxy
+		static void updateFilter(ProxyID* id);
+		// true if no collider of one body can ever collide with the other
+		static bool isFiltered(const ProxyID* a, const ProxyID* b);
+
+	private:
+		PairManager m_pairManager;
+		std::vector<Pair> m_pairs;
+		std::vector<int> m_pairIDs;
+	};
+
+
+	inline bool Broadphase::isFiltered(const ProxyID* a, const ProxyID* b)
+	{
+		return (a->collisionGroup & b->collisionFilter) != 0 || (b->collisionGroup & a->collisionFilter) != 0;
+	}
+
+	inline const Pair* Broadphase::getPairs() const
+	{
+		return m_pairs.data();
+	}
+
+	inline const int* Broadphase::getPairIDs() const
+	{
+		return m_pairIDs.data();
+	}
+
+	inline PairManager& Broadphase::getPairManager()
+	{
+		return m_pairManager;
+	}
+
+
+	// cell table occupancy, summed over the dynamic and the static table
+	struct HGridStats
+	{
+		int numCells; // slots of both tables
+		int numUsedCells;
+		int numObjects;
+		int maxObjectsPerCell;
+		int maxProbeLength;
+		// used slots of the fuller table, the table grows above the max load factor
+		float loadFactor;
+	};
+
+
+	class HGrid : public Broadphase
 	{
 	public:
 		static const int MAX_LEVELS = 100;
-		static const int NUM_BUCKETS = 1024; //todo test for good number
+		static const int DEFAULT_NUM_CELLS = 1024;
+		static const float DEFAULT_MAX_LOAD_FACTOR;
 		static const float MIN_CELL_SIZE;
 		static const float CELL_TO_CELL_RATIO;
 		static const float SPHERE_TO_CELL_RATIO;
 		
-		HGrid();
+		// numCells is rounded up to a power of two,
+		// a table doubles once more than maxLoadFactor of its slots are used
+		HGrid(int numCells = DEFAULT_NUM_CELLS, float maxLoadFactor = DEFAULT_MAX_LOAD_FACTOR);
 
 		const ProxyID* addBody(Body* pBody);
 		void removeBody(const ProxyID* pProxyID);
 		
-		void updateBody(const ProxyID* pProxyID);
+		void updateBody(const ProxyID* pProxyID, const vec3& displacement = vec3(0.0f, 0.0f, 0.0f));
 		
-		int generatePairs(Pair* pairs);
+		int generatePairs(std::vector<Pair>* pairs, JobSystem* jobSystem = nullptr);
 
 		bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX);
+		int queryRays(const Ray* rays, int n, RayQueryResult* hits, JobSystem* jobSystem = nullptr);
+		bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX);
 		bool queryCollider(const Collider* collider);
 		bool queryCollider(Collider* collider, ColliderQueryCallBack callback);
 		bool queryShape(ShapePtr shape, const Transform& transform);
 		bool queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData);
 
+		void getStats(HGridStats* stats) const;
+
 	private:
+		static const uint64 EMPTY_CELL = ~0ull;
+		static const uint64 LEVEL_MASK = 0x7f;
+		// dynamic objects per pair job
+		static const int PAIR_GRAIN_SIZE = 64;
+		// rays are traversed in packets of RAY_PACKET_SIZE, rays per job
+		static const int RAY_GRAIN_SIZE = 64;
+
+		struct Cell
+		{
+			uint64 key;
+			int first; // first object of the cell
+		};
+
+		struct Grid
+		{
+			Grid(int numCells);
+
+			int occupiedLevelsMask;
+			int objectsAtLevel[MAX_LEVELS];
+
+			// open addressing with linear probing, one slot per occupied cell
+			std::vector<Cell> cells;
+			int numUsedCells;
+
+			// objects, the idx of a proxy indexes these
+			std::vector<vec3> centers;
+			std::vector<float> radii;
+			std::vector<AABB> fatAABBs;
+			// tight bounds per axis, copied on every update
+			std::vector<float> aabbMin[3];
+			std::vector<float> aabbMax[3];
+			std::vector<uint64> keys;
+			std::vector<int> next; // objects of the same cell
+			std::vector<int> prev;
+			std::vector<Body*> bodies;
+			std::vector<uint32> groups; // collision masks of the bodies
+			std::vector<uint32> filters;
+			std::vector<ProxyID*> ids;
+
+			vec3 minExtend;
+			vec3 maxExtend;
+		};
 
-		struct Object
+		// state of the ray queries of one worker of a batch
+		struct RayQueryContext
 		{
-			Sphere sphere;
-			ProxyID* id;
-			//debug
-			int x, y, z;
+			uint32 tick;
+			std::vector<uint32> stamps; // last packet that tested an object
 		};
 
+		static uint64 calculateCellKey(int x, int y, int z, int level);
+		static uint32 hashCellKey(uint64 key);
 
-		int calculateBucketID(int x, int y, int z, int level);
-		void removeFromBucket(const ProxyID* id);
-		void removeFromLevel(const ProxyID* id);
+		Grid& getGrid(const ProxyID* id);
 
-		int m_occupiedLevelsMask;
-		int m_objectsAtLevel[MAX_LEVELS];
-		std::vector<Object> m_objectBucket[NUM_BUCKETS];
-		int m_timeStamp[NUM_BUCKETS];
-		int m_tick;
+		// returns the slot of the cell, -1 if it is empty
+		int findCell(const Grid& grid, uint64 key) const;
+		void addToCell(Grid& grid, int object);
+		void removeFromCell(Grid& grid, int object);
+		void eraseCell(Grid& grid, int slot);
+		void rehash(Grid& grid, int numCells);
 
-		vec3 m_minExtend;
-		vec3 m_maxExtend;
+		static void setAABB(Grid& grid, int object, const AABB& aabb);
+		static AABB getAABB(const Grid& grid, int object);
+
+		void removeObject(Grid& grid, int object);
+		void removeFromLevel(Grid& grid, int level);
+
+		void generatePairs(int begin, int end, std::vector<Pair>* pairs);
+		void generatePairs(int object, const Grid& grid, std::vector<Pair>* pairs);
+
+		void prepareRayContexts(int numThreads);
+
+		// calls visit(object) for the objects near the cells the ray passes until tmax,
+		// objects can be visited more than once. returns false if visit returned false
+		template<typename F>
+		bool walkRay(const Grid& grid, const vec3& origin, const vec3& dir, const float& tmax, const F& visit) const;
+
+		void queryRays(int begin, int end, const Ray* rays, RayQueryResult* hits, RayQueryContext& context) const;
+		void queryRays(const Grid& grid, const Ray* rays, int count, RayQueryResult* hits, RayQueryContext& context) const;
+		bool queryOcclusion(const Grid& grid, const vec3& origin, const vec3& dir, float tmax, RayQueryContext& context) const;
+		bool queryCollider(const Grid& grid, const Collider* collider);
+		bool queryCollider(const Grid& grid, Collider* collider, ColliderQueryCallBack callback, bool& stop);
+		bool queryShape(const Grid& grid, ShapePtr shape, const Transform& transform);
+		bool queryShape(const Grid& grid, ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData, bool& stop);
+
+		// static bodies only have to be tested against dynamic ones
+		Grid m_dynamic;
+		Grid m_static;
+
+		float m_maxLoadFactor;
+
+		// output of the pair jobs, merged in job order
+		std::vector<std::vector<Pair>> m_jobPairs;
+		// one per worker of the running batch, single queries use the first
+		std::vector<RayQueryContext> m_rayContexts;
 
 		Allocator<ProxyID> m_proxyIDAllocator;
 	};
 
-	inline int HGrid::calculateBucketID(int x, int y, int z, int level)
+	// 19 bits per coordinate and 7 bits for the level, 
+	// cells more than 2^18 cells apart wrap around
+	inline uint64 HGrid::calculateCellKey(int x, int y, int z, int level)
 	{
-		const int32 h1 = 12582917;
-		const int32 h2 = 25165843;
-		const int32 h3 = 50331653;
-		const int32 h4 = 100663319;
+		const uint64 mask = (1 << 19) - 1;
 
-		int n = x*h1 + y*h2 + z * h3 + level * h4;
+		return (((uint64)x & mask) << 45) | (((uint64)y & mask) << 26) | (((uint64)z & mask) << 7) | (uint64)level;
+	}
 
-		//elf hash
-		unsigned char* p = (unsigned char*)&n;
-		int h = 0, g;
-		for (int i = 0; i < sizeof(int); ++i)
-		{
-			h = (h << 4) + p[i];
-			g = h & 0xf0000000L;
-			if (g != 0)
-			{
-				h ^= g >> 24;
-			}
-			
-			h &= ~g;
-		}
+	inline uint32 HGrid::hashCellKey(uint64 key)
+	{
+		// murmur3 finalizer
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdull;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ull;
+		key ^= key >> 33;
+
+		return (uint32)key;
+	}
 
-		h = h%NUM_BUCKETS;
-		if (h < 0) h += NUM_BUCKETS;
+	inline int HGrid::findCell(const Grid& grid, uint64 key) const
+	{
+		int mask = (int)grid.cells.size() - 1;
 
+		for (int slot = hashCellKey(key) & mask; grid.cells[slot].key != EMPTY_CELL; slot = (slot + 1) & mask)
+		{
+			if (grid.cells[slot].key == key)
+				return slot;
+		}
 
-		h = h%NUM_BUCKETS;
-		return h;
+		return -1;
 	}
 
 	inline bool operator==(const Pair& lhs, const Pair& rhs)
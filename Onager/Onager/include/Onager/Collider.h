@@ -169,16 +169,6 @@ namespace ong
 		m_pUserData = pUserData;
 	}
 
-	inline void Collider::setCollisionGroup(uint32 collisionGroup)
-	{
-		m_collisionGroup = collisionGroup;
-	}
-
-	inline void Collider::setCollisionFilter(uint32 collisionFilter)
-	{
-		m_collisionFilter = collisionFilter;
-	}
-
 	inline void Collider::setCallbacks(const ColliderCallbacks& callbacks)
 	{
 		m_callbacks = callbacks;
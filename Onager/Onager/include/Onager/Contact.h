@@ -1,6 +1,7 @@
 #pragma once
 
 #include "myMath.h"
+#include "defines.h"
 #include <vector>
 
 
@@ -11,6 +12,7 @@ namespace ong
 
 	class Collider;
 	class Body;
+	struct ContactIter;
 
 	const int MAX_CONTACT_POINTS = 4;
 
@@ -51,6 +53,10 @@ namespace ong
 			} hullFace;
 		};
 
+		// relative transform of the shapes when the feature was found,
+		// used by the SAT to decide if the feature can be reused
+		Transform relative;
+
 	};
 
 	inline bool operator==(const Feature& lhs, const Feature& rhs)
@@ -84,18 +90,18 @@ namespace ong
 		float accImpulseT[MAX_CONTACT_POINTS]; // tangent impulse
 		float accImpulseBT[MAX_CONTACT_POINTS]; // bitangent impulse
 
-		float massN[MAX_CONTACT_POINTS]; // mass along normal
-		float massT[MAX_CONTACT_POINTS]; // mass along tangent
-		float massBT[MAX_CONTACT_POINTS]; // mass along bitangent
-
-		vec3 rA[MAX_CONTACT_POINTS]; 
-		vec3 rB[MAX_CONTACT_POINTS]; 
-
 		float friction;
 		float e; // restitution
 		ContactManifold manifold;
 
 		int tick; //last update
+		uint32 islandTick; //last island build
+
+		int index; // position in the list of the contact manager
+		// entries in the contact lists of the bodies, 
+		// each one is in the list of the body the other one points to
+		ContactIter* iterA;
+		ContactIter* iterB;
 	};
 
 
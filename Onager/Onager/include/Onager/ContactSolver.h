@@ -7,13 +7,44 @@ namespace ong
 {
 	struct WorldContext;
 
+	// packed copy of a contact, built once per step so the solver
+	// iterations never have to touch the Contact, Collider or Body
 	struct ContactConstraint
 	{
-		float veloctiyBias[MAX_CONTACT_POINTS];
+		int bodyA;
+		int bodyB;
+
+		// static and sleeping bodies are read but never written
+		bool activeA;
+		bool activeB;
+
+		int numPoints;
+
+		vec3 normal;
+		vec3 tangent;
+		vec3 biTangent;
+
+		float friction;
+
+		vec3 rA[MAX_CONTACT_POINTS];
+		vec3 rB[MAX_CONTACT_POINTS];
+
+		float massN[MAX_CONTACT_POINTS]; // mass along normal
+		float massT[MAX_CONTACT_POINTS]; // mass along tangent
+		float massBT[MAX_CONTACT_POINTS]; // mass along bitangent
+
+		float velocityBias[MAX_CONTACT_POINTS];
+
+		float accImpulseN[MAX_CONTACT_POINTS];
+		float accImpulseT[MAX_CONTACT_POINTS];
+		float accImpulseBT[MAX_CONTACT_POINTS];
 	};
 
 
-	void preSolveContacts(WorldContext* w, Contact** contacts, int numContacts, float invDt, ContactConstraint* contactConstraints);
-	void solveContacts(WorldContext* w, Contact** contacts, int numContacts, ContactConstraint* constraints);
+	// fills one constraint per contact and applies the warmstart
+	void preSolveContacts(WorldContext* w, Contact** contacts, int numContacts, float invDt, ContactConstraint* constraints);
+	// one velocity iteration, returns the largest change of an accumulated impulse
+	float solveContacts(WorldContext* w, ContactConstraint* constraints, int numConstraints);
+	// writes the accumulated impulses back to the contacts, does not call the postSolve callbacks
 	void postSolveContacts(WorldContext* w, Contact** contacts, int numContacts, ContactConstraint* constraints);
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "Contact.h"
+#include "ContactSolver.h"
+#include <xmmintrin.h>
+
+namespace ong
+{
+	struct WorldContext;
+	class LinearAllocator;
+
+
+	const int SIMD_WIDTH = 4;
+
+	struct SimdVec3
+	{
+		__m128 x;
+		__m128 y;
+		__m128 z;
+	};
+
+	// SIMD_WIDTH contacts without a shared awake body, one per lane.
+	// unused lanes and points have zero mass and never produce an impulse.
+	struct ContactBatch
+	{
+		struct Point
+		{
+			SimdVec3 rA;
+			SimdVec3 rB;
+
+			__m128 massN;
+			__m128 massT;
+			__m128 massBT;
+
+			__m128 velocityBias;
+
+			__m128 accImpulseN;
+			__m128 accImpulseT;
+			__m128 accImpulseBT;
+		};
+
+		SimdVec3 normal;
+		SimdVec3 tangent;
+		SimdVec3 biTangent;
+
+		__m128 friction;
+
+		// world space, zero for static and sleeping bodies
+		__m128 invMA;
+		__m128 invMB;
+		__m128 invIA[9];
+		__m128 invIB[9];
+
+		Point points[MAX_CONTACT_POINTS];
+
+		// -1 if not awake, the body is then treated as immovable and never written
+		int bodyA[SIMD_WIDTH];
+		int bodyB[SIMD_WIDTH];
+
+		ContactConstraint* constraints[SIMD_WIDTH];
+		int numPoints;
+	};
+
+	struct ContactBatches
+	{
+		// batches are sorted by color, batches of one color can be solved in any order
+		int numColors;
+		int* colorStart; // numColors + 1 entries
+
+		int numBatches;
+		ContactBatch* batches;
+
+		// constraints of bodies that ran out of colors, solved with the scalar solver
+		int numOverflow;
+		ContactConstraint* overflow; // packed copies
+		ContactConstraint** overflowSource;
+	};
+
+	// colors the constraints and packs them into batches,
+	// constraints have to be presolved already
+	void prepareContactBatches(WorldContext* w, ContactConstraint* constraints, int numConstraints, int numBodies, LinearAllocator* allocator, ContactBatches* out);
+	// returns the largest change of an accumulated impulse
+	float solveContactBatches(WorldContext* w, ContactBatch* batches, int numBatches);
+	// writes the accumulated impulses back to the constraints
+	void finishContactBatches(ContactBatches* batches);
+}
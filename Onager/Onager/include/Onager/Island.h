@@ -0,0 +1,43 @@
+#pragma once
+
+#include "defines.h"
+
+namespace ong
+{
+
+	class Body;
+	struct Contact;
+	class LinearAllocator;
+
+
+	struct Island
+	{
+		int bodyStart;
+		int numBodies;
+		int contactStart;
+		int numContacts;
+	};
+
+	struct IslandSet
+	{
+		int numIslands;
+		Island* islands;
+
+		// grouped by island
+		int numBodies;
+		Body** bodies;
+
+		// grouped by island
+		int numContacts;
+		Contact** contacts;
+	};
+
+
+	// finds the connected groups of awake bodies linked by touching contacts.
+	// static bodies do not link islands, sleeping bodies reached from an awake body are woken up.
+	// an island only holds the touching contacts of its bodies.
+	// tick has to be different for each call.
+	// all arrays are allocated from allocator.
+	void buildIslands(Body** bodies, int numBodies, int numContacts, uint32 tick, LinearAllocator* allocator, IslandSet* islands);
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "defines.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace ong
+{
+
+	// processes the range [begin, end), thread is in [0, numThreads)
+	typedef void(*JobFunc)(int begin, int end, int thread, void* userData);
+
+
+	// simple fork/join worker pool.
+	// a parallelFor splits its range into fixed jobs of grainSize elements,
+	// so the partition only depends on the count and never on the number of threads.
+	// results stay deterministic as long as a job only writes data owned by its range.
+	class JobSystem
+	{
+	public:
+		// numThreads includes the calling thread, <= 1 runs everything on the calling thread
+		JobSystem(int numThreads);
+		~JobSystem();
+
+		// blocks until all jobs are done
+		void parallelFor(int count, int grainSize, JobFunc func, void* userData);
+
+		// f(int begin, int end, int thread)
+		template<typename F>
+		void parallelFor(int count, int grainSize, const F& f);
+
+		int getNumThreads() const;
+
+	private:
+		JobSystem(const JobSystem&);
+		JobSystem& operator=(const JobSystem&);
+
+		void workerMain(int thread);
+		void work(int thread);
+
+		template<typename F>
+		static void invoke(int begin, int end, int thread, void* userData);
+
+		std::vector<std::thread> m_workers;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+
+		uint32 m_generation;
+		int m_numActiveWorkers;
+		bool m_quit;
+
+		JobFunc m_func;
+		void* m_userData;
+		int m_count;
+		int m_grainSize;
+		int m_numJobs;
+
+		std::atomic<int> m_nextJob;
+		std::atomic<int> m_numPendingJobs;
+	};
+
+
+	template<typename F>
+	void JobSystem::invoke(int begin, int end, int thread, void* userData)
+	{
+		(*(const F*)userData)(begin, end, thread);
+	}
+
+	template<typename F>
+	inline void JobSystem::parallelFor(int count, int grainSize, const F& f)
+	{
+		parallelFor(count, grainSize, invoke<F>, (void*)&f);
+	}
+
+	inline int JobSystem::getNumThreads() const
+	{
+		return (int)m_workers.size() + 1;
+	}
+
+}
@@ -16,37 +16,134 @@ namespace ong
 
 
 	struct Pair;
+	class PairManager;
+	class JobSystem;
+
+
+	// state of two colliders whose bodies overlap in the broadphase.
+	// it lives as long as the broadphase pair, so the feature is kept while the colliders are apart
+	struct ColliderPair
+	{
+		Collider* colliderA;
+		Collider* colliderB;
+
+		Contact* contact; // nullptr while the colliders do not touch
+		Feature feature; // separating axis or contact feature, found with colliderA first
+
+		ColliderPair* next; // next of the same broadphase pair
+	};
+
+
+	// maps collider pairs to their state, the order of the colliders does not matter.
+	// open addressing with linear probing, grows once half of the slots are used
+	class ContactCache
+	{
+	public:
+		ContactCache(int numSlots = DEFAULT_NUM_SLOTS);
+
+		// nullptr if the colliders have no state
+		ColliderPair* find(const Collider* a, const Collider* b) const;
+
+		// the state is keyed by its colliders, which may swap but must not change until it is removed
+		void insert(ColliderPair* colliderPair);
+		void remove(const ColliderPair* colliderPair);
+
+	private:
+		static const int DEFAULT_NUM_SLOTS = 256;
+
+		struct Slot
+		{
+			const Collider* a; // lower address
+			const Collider* b;
+			ColliderPair* colliderPair; // nullptr if empty
+		};
+
+		static uint32 hash(const Collider* a, const Collider* b);
+
+		// returns the slot of the pair, -1 if it has no state
+		int findSlot(const Collider* a, const Collider* b) const;
+		void rehash(int numSlots);
+
+		std::vector<Slot> m_slots;
+		int m_numUsedSlots;
+	};
 
 
-	// todo persistent contacts
 	class ContactManager
 	{
 	public:
 		ContactManager();
 
-		void generateContacts(Pair* pairs, int numPairs, int maxContacts);
+		// the state of the colliders is kept with the persistent pairs of the broadphase
+		void setPairManager(PairManager* pairManager);
+
+		// ids are the persistent ids of the pairs.
+		// manifolds may be computed in parallel on the job system,
+		// contacts are updated in pair order afterwards
+		void generateContacts(const Pair* pairs, const int* ids, int numPairs, int maxContacts, JobSystem* jobSystem = nullptr);
 		void removeBody(Body* body);
+		// removes the contacts of all bodies in a single pass
+		void removeBodies(Body* const* bodies, int numBodies);
 		void removeContact(Contact* pContact);
+		// the state of the collider is dropped before the next contacts are generated
+		void removeCollider(Collider* collider);
 
 		Contact** getContacts(int* numContacts);
 
 
 	private:
-		void collide(Body* a, Body* b);
-
-		void collide(BVTree* tree1, BVTree* tree2, BVTree* a, BVTree* b, const vec3& t, const mat3x3& rot);
-		void collide(BVTree* tree, BVTree* a, Collider* b, const vec3& t, const mat3x3& rot);
-		void collide(Collider* c1, Collider* c2);
+		// pairs per narrowphase job
+		static const int PAIR_GRAIN_SIZE = 16;
+
+		// touching colliders found by the narrowphase,
+		// or colliders that are apart along a new separating axis
+		struct Collision
+		{
+			Collider* colliderA;
+			Collider* colliderB;
+			int pair;
+			bool touching;
+			ContactManifold manifold;
+			Feature feature;
+		};
+
+		// the collide functions only append to collisions and can run in parallel
+		void collide(Body* a, Body* b, int pair, std::vector<Collision>* collisions) const;
+
+		void collide(BVTree* tree1, BVTree* tree2, BVTree* a, BVTree* b, const vec3& t, const mat3x3& rot, int pair, std::vector<Collision>* collisions) const;
+		void collide(BVTree* tree, BVTree* a, Collider* b, const vec3& t, const mat3x3& rot, int pair, std::vector<Collision>* collisions) const;
+		void collide(Collider* c1, Collider* c2, int pair, std::vector<Collision>* collisions) const;
+
+		// creates or updates the state and the contact of the collision
+		void updateContact(const Collision& collision);
+		// drops the state of ended pairs and removed colliders
+		void releaseColliderPairs();
+		// does not unlink it from its pair, a remaining contact ends with the stale contacts
+		void releaseColliderPair(ColliderPair* colliderPair);
 
 		void removeContact(int contact);
+		// ends the contact and frees it, does not touch m_contacts
+		void releaseContact(Contact* contact);
 
 		uint32 m_tick;
+		PairManager* m_pairManager;
+		ContactCache m_contactCache;
 		std::vector<Contact*> m_contacts;
+		std::vector<Collider*> m_removedColliders;
+		// output of the narrowphase jobs, applied in job order
+		std::vector<std::vector<Collision>> m_jobCollisions;
 		Allocator<Contact> m_contactAllocator;
 		Allocator<ContactIter> m_contactIterAllocator;
+		Allocator<ColliderPair> m_colliderPairAllocator;
 	};
 
 
+	inline void ContactManager::setPairManager(PairManager* pairManager)
+	{
+		m_pairManager = pairManager;
+	}
+
+
 	inline Contact** ContactManager::getContacts(int* numContacts)
 	{
 		if (numContacts)
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "defines.h"
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+
+
+namespace ong
+{
+	class Body;
+	struct Pair;
+	struct ColliderPair;
+
+
+	struct PersistentPair
+	{
+		Body* A;
+		Body* B;
+
+		// state of the colliders of both bodies, owned by the contact manager
+		ColliderPair* colliderPairs;
+
+		uint32 tick; // last update the pair was reported
+		bool ended;
+	};
+
+
+	// keeps the overlapping body pairs of the broadphase between steps.
+	// pair ids stay the same as long as the bodies overlap,
+	// pairs that began or ended are reported after each update.
+	class PairManager
+	{
+	public:
+		PairManager();
+
+		// ids receives the id of every pair
+		void update(const Pair* pairs, int numPairs, int* ids);
+
+		// the pairs of removed bodies end in the next update,
+		// the bodies are not accessed anymore
+		void removeBody(Body* body);
+		void removeBodies(Body* const* bodies, int numBodies);
+
+		PersistentPair& getPair(int id);
+		// ids below are valid for getPair, the pair of an id may have ended
+		int getNumPairIDs() const;
+
+		// pairs that began or ended during the last update,
+		// ended pairs stay valid until the next update
+		const std::vector<int>& getBeginPairs() const;
+		const std::vector<int>& getEndPairs() const;
+
+	private:
+		struct Key
+		{
+			Body* a;
+			Body* b;
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const;
+		};
+
+		struct KeyEqual
+		{
+			bool operator()(const Key& lhs, const Key& rhs) const;
+		};
+
+		static Key makeKey(Body* a, Body* b);
+
+		int allocatePair();
+		void endPair(int id);
+
+		uint32 m_tick;
+
+		std::vector<PersistentPair> m_pairs;
+		std::vector<int> m_freePairs;
+		std::unordered_map<Key, int, KeyHash, KeyEqual> m_index;
+
+		std::vector<int> m_begin;
+		std::vector<int> m_end;
+
+		std::vector<Body*> m_removedBodies;
+	};
+
+
+	inline PersistentPair& PairManager::getPair(int id)
+	{
+		return m_pairs[id];
+	}
+
+	inline int PairManager::getNumPairIDs() const
+	{
+		return (int)m_pairs.size();
+	}
+
+	inline const std::vector<int>& PairManager::getBeginPairs() const
+	{
+		return m_begin;
+	}
+
+	inline const std::vector<int>& PairManager::getEndPairs() const
+	{
+		return m_end;
+	}
+
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "myMath.h"
+#include "Shapes.h"
+#include <xmmintrin.h>
+
+namespace ong
+{
+
+	const int RAY_PACKET_SIZE = 4;
+
+	// up to RAY_PACKET_SIZE rays in SoA, one per lane.
+	// lanes of a smaller packet repeat the first ray, the kernels return a bit for every lane
+	struct RayPacket
+	{
+		__m128 origin[3];
+		__m128 dir[3];
+		// parallel rays only hit boxes whose slab they start in
+		__m128 ooDir[3];
+	};
+
+	void setRayPacket(RayPacket* packet, const vec3* origins, const vec3* dirs, int count);
+
+	// returns a bit per lane whose ray enters the box before tmax
+	int intersectRayPacketAABB(const RayPacket& packet, const AABB& aabb, __m128 tmax);
+	// same as intersectRaySphere for every lane, tmin receives the entry of the lanes that hit
+	int intersectRayPacketSphere(const RayPacket& packet, const Sphere* sphere, __m128* tmin);
+
+
+	inline float getRayPacketLane(const __m128& v, int lane)
+	{
+		return ((const float*)&v)[lane];
+	}
+
+}
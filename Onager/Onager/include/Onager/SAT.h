@@ -25,10 +25,20 @@ namespace ong
 	struct ContactManifold;
 	struct Feature;
 
+	// if feature holds the feature of the last frame its axis is tested first,
+	// feature receives the separating axis or the contact feature.
+	// face contacts skip the face and edge directions while the shapes barely move relative to each other
 	void SAT(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, ContactManifold* manifold, Feature* feature = nullptr);
 
 	void queryFaceDirections(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, FaceQuery* out);
+	// tests four edges of hull2 at once and culls edge pairs on the gauss map before computing their distance
 	void queryEdgeDirections(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, EdgeQuery* out);
+	// scalar reference of queryEdgeDirections
+	void queryEdgeDirectionsScalar(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, EdgeQuery* out);
+
+	// separation along a single face normal or edge pair, -FLT_MAX if the edges do not build a face of the minkowski difference
+	float queryFaceDirection(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, int index);
+	float queryEdgeDirection(const Hull* hull1, const Transform* t1, const Hull* hull2, const Transform* t2, int index1, int index2);
 
 
 }
\ No newline at end of file
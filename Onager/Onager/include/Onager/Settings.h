@@ -5,3 +5,13 @@
 
 #define ong_OVERLAP_EPSILON (10.0f * FLT_EPSILON)
 
+// bodies slower than this are allowed to fall asleep
+#define ong_LINEAR_SLEEP_TOLERANCE 0.05f
+#define ong_ANGULAR_SLEEP_TOLERANCE (2.0f / 180.0f * 3.14159265359f)
+// time a whole island has to be at rest before it falls asleep
+#define ong_TIME_TO_SLEEP 0.5f
+
+// broadphase proxies are enlarged by this margin and by the predicted 
+// displacement times ong_AABB_DISPLACEMENT_MULTIPLIER, they are only updated once the body leaves them
+#define ong_AABB_MARGIN 0.1f
+#define ong_AABB_DISPLACEMENT_MULTIPLIER 2.0f
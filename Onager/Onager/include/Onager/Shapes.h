@@ -194,6 +194,10 @@ namespace ong
 	bool intersectRayHull(const vec3& origin, const vec3& dir, const Hull* hull, float& tmin, vec3& p, vec3& n);
 	bool intersectRaySphere(const vec3& origin, const vec3& dir, const Sphere* sphere, float& tmin, vec3& p, vec3& n);
 	bool intersectRayCapsule(const vec3& origin, const vec3& dir, const Capsule* capsule, float& tmin, vec3& p, vec3& n);
+	// any hit up to tmax, without point and normal
+	bool intersectRayHull(const vec3& origin, const vec3& dir, const Hull* hull, float tmax);
+	bool intersectRaySphere(const vec3& origin, const vec3& dir, const Sphere* sphere, float tmax);
+	bool intersectRayCapsule(const vec3& origin, const vec3& dir, const Capsule* capsule, float tmax);
 
 	//aaabb
 
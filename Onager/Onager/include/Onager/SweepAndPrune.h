@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Broadphase.h"
+#include <unordered_map>
+
+
+namespace ong
+{
+
+	// incremental sweep and prune over the enlarged AABBs of the bodies.
+	// the endpoints of every axis stay sorted with insertion sort,
+	// so coherent motion only costs a few swaps per body.
+	// overlaps are tracked when endpoints pass each other and kept between steps.
+	// queries test every proxy, this backend is meant for pair generation.
+	class SweepAndPrune : public Broadphase
+	{
+	public:
+		SweepAndPrune();
+
+		const ProxyID* addBody(Body* pBody);
+		void removeBody(const ProxyID* pProxyID);
+
+		void updateBody(const ProxyID* pProxyID, const vec3& displacement = vec3(0.0f, 0.0f, 0.0f));
+
+		int generatePairs(std::vector<Pair>* pairs, JobSystem* jobSystem = nullptr);
+
+		bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX);
+		bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX);
+		bool queryCollider(const Collider* collider);
+		bool queryCollider(Collider* collider, ColliderQueryCallBack callback);
+		bool queryShape(ShapePtr shape, const Transform& transform);
+		bool queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData);
+
+	private:
+
+		struct Endpoint
+		{
+			float value;
+			uint32 data; // box << 1 | isMax
+		};
+
+		struct Box
+		{
+			AABB aabb;
+			int min[3]; // endpoint indices
+			int max[3];
+			ProxyID* id; // nullptr if free
+			bool isStatic;
+		};
+
+		static bool less(const Endpoint& a, const Endpoint& b);
+		static bool overlap(const Box& a, const Box& b);
+
+		void setEndpoints(int box);
+		void sortDown(int axis, int index);
+		void sortUp(int axis, int index);
+
+		void addOverlap(int a, int b);
+		void removeOverlap(int a, int b);
+
+		std::vector<Endpoint> m_endpoints[3];
+		std::vector<Box> m_boxes;
+		std::vector<int> m_freeBoxes;
+
+		// box pairs with overlapping enlarged AABBs, static pairs are never tracked
+		std::vector<uint64> m_overlaps;
+		std::unordered_map<uint64, int> m_overlapIndex;
+
+		Allocator<ProxyID> m_proxyIDAllocator;
+	};
+
+}
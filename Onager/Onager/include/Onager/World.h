@@ -10,7 +10,10 @@
 #include "Shapes.h"
 #include "Allocator.h"
 #include "Broadphase.h"
+#include "AABBTree.h"
+#include "SweepAndPrune.h"
 #include "Narrowphase.h"
+#include "JobSystem.h"
 
 
 namespace ong
@@ -23,6 +26,53 @@ namespace ong
 	typedef Allocator<Capsule> CapsuleAllocator;
 	typedef Allocator<Material> MaterialAllocator;
 
+	struct IslandSet;
+	struct WorldContext;
+	struct ContactConstraint;
+
+
+	struct SolverMode
+	{
+		enum Type
+		{
+			// one Gauss-Seidel pass over all contacts
+			SEQUENTIAL,
+			// contacts are partitioned by island and the islands are solved in parallel
+			ISLANDS,
+			// contacts are colored into batches without shared bodies, 
+			// each batch is solved with SSE and the batches of one color in parallel
+			SIMD,
+		};
+	};
+
+
+	struct WorldSettings
+	{
+		WorldSettings();
+
+		vec3 gravity;
+
+		// initial size of the per step scratch memory, 
+		// it grows to the high water mark if exceeded
+		size_t frameMemorySize;
+		// number of threads used by step including the calling thread
+		int numThreads;
+
+		SolverMode::Type solverMode;
+		BroadphaseType::Type broadphase;
+
+		// initial slot count of the HGrid cell tables, 
+		// a table doubles once more than hgridMaxLoadFactor of its slots are used
+		int hgridNumCells;
+		float hgridMaxLoadFactor;
+
+		// the velocity solver runs at least minIterations and at most maxIterations,
+		// in between it stops once no accumulated impulse changes by more than impulseTolerance
+		int minIterations;
+		int maxIterations;
+		float impulseTolerance;
+	};
+
 
 
 
@@ -30,20 +80,25 @@ namespace ong
 	//	
 	//	-sensors
 	//	-continuos collision detection
-	//	-sleeping
 	//
 	//	-hull memory leaking
 
 	class World
 	{
 	public:
+		static const size_t DEFAULT_FRAME_MEMORY_SIZE = 1024 * 1024;
+
 		World(const vec3& gravity = vec3(0.0f, 0.0f, 0.0f));
+		World(const WorldSettings& settings);
+		~World();
 
 		//simulation step, dt should be constant
 		void step(float dt);
 
 		Body* createBody(const BodyDescription& description);
 		void destroyBody(Body* pBody);
+		// faster than destroying the bodies one by one
+		void destroyBodies(Body* const* bodies, int numBodies);
 
 		//create new Collider
 		Collider* createCollider(const ColliderDescription& description);
@@ -57,13 +112,32 @@ namespace ong
 		ShapePtr createShape(const ShapeDescription& descr);
 		void destroyShape(ShapePtr shape);
 
+		// the queries are single caller, they must not run concurrently
+		// with each other or with step
 		bool queryRay(const vec3& origin, const vec3& dir, RayQueryResult* hit, float tmax = FLT_MAX);
+		// casts n rays at once on the worker threads, returns the number of hits.
+		// hits without collider are misses, neighbouring rays should be coherent.
+		// the HGrid walks packets of four rays through its cells and the body trees,
+		// sphere colliders are tested four rays at once and other shapes ray by ray
+		int queryRays(const Ray* rays, int n, RayQueryResult* hits);
+		// true if the ray hits anything before tmax, 
+		// stops at the first hit and is cheaper than queryRay for visibility checks
+		bool queryOcclusion(const vec3& origin, const vec3& dir, float tmax = FLT_MAX);
 		bool queryCollider(const Collider* collider);
 		bool queryCollider(Collider* collider, ColliderQueryCallBack callback);
 		bool queryShape(ShapePtr shape, const Transform& transform);
 		bool queryShape(ShapePtr shape, const Transform& transform, ShapeQueryCallBack callback, void* userData);
 
 		inline void World::setGravity(const vec3& gravity);
+		void setSolverMode(SolverMode::Type mode);
+		void setSolverIterations(int minIterations, int maxIterations, float impulseTolerance);
+
+		// peak scratch memory used by a single step
+		size_t getFrameMemoryHighWaterMark() const;
+		// velocity iterations used by the last step, the maximum over all islands
+		int getSolverIterations() const;
+		// returns false if the broadphase is not an HGrid
+		bool getHGridStats(HGridStats* stats) const;
 
 		
 
@@ -73,6 +147,8 @@ namespace ong
 
 		void updateProxy(const ProxyID* proxyID);
 		void removeContact(Contact* pContact);
+		// the collider left its body
+		void removeCollider(Collider* pCollider);
 
 		//	--ACCESSORS--
 
@@ -89,16 +165,39 @@ namespace ong
 
 	private:
 
-		static const int NUN_VELOCITY_ITERATIONS = 8;
+		int solveSequential(WorldContext* context, ContactConstraint* constraints, int numConstraints);
+		void solveIslands(WorldContext* context, const IslandSet* islands, float dt);
+		void solveBatches(WorldContext* context, Contact** contacts, int numContacts, float dt);
+		void updateSleeping(const IslandSet* islands, float dt);
+
+		// frees the body once its contacts and pairs are gone
+		void freeBody(Body* pBody);
+
+		// bodies per job
+		static const int BODY_GRAIN_SIZE = 64;
+		// contact batches per job
+		static const int BATCH_GRAIN_SIZE = 16;
 
 		Body* m_pBody;
 		int m_numBodies;
 		int m_numColliders;
 		vec3 m_gravity;
+		SolverMode::Type m_solverMode;
+
+		int m_minIterations;
+		int m_maxIterations;
+		float m_impulseTolerance;
+		int m_solverIterations;
 
-		HGrid m_hGrid;
+		Broadphase* m_broadphase;
+		BroadphaseType::Type m_broadphaseType;
 		ContactManager m_contactManager;
 
+		LinearAllocator m_frameAllocator;
+		JobSystem m_jobSystem;
+
+		uint32 m_islandTick;
+
 		BodyAllocator m_bodyAllocator;
 		ColliderAllocator m_colliderAllocator;
 		HullAllocator m_hullAllocator;
@@ -109,10 +208,58 @@ namespace ong
 
 
 
+	inline WorldSettings::WorldSettings()
+		: gravity(0.0f, 0.0f, 0.0f),
+		frameMemorySize(World::DEFAULT_FRAME_MEMORY_SIZE),
+		numThreads(1),
+		solverMode(SolverMode::SEQUENTIAL),
+		broadphase(BroadphaseType::HGRID),
+		hgridNumCells(HGrid::DEFAULT_NUM_CELLS),
+		hgridMaxLoadFactor(HGrid::DEFAULT_MAX_LOAD_FACTOR),
+		minIterations(8),
+		maxIterations(16),
+		impulseTolerance(1e-3f)
+	{
+	}
+
+
 	inline void World::setGravity(const vec3& gravity)
 	{
 		m_gravity = gravity;
 	}
+
+	inline void World::setSolverMode(SolverMode::Type mode)
+	{
+		m_solverMode = mode;
+	}
+
+	inline void World::setSolverIterations(int minIterations, int maxIterations, float impulseTolerance)
+	{
+		assert(minIterations >= 1 && minIterations <= maxIterations);
+
+		m_minIterations = minIterations;
+		m_maxIterations = maxIterations;
+		m_impulseTolerance = impulseTolerance;
+	}
+
+	inline size_t World::getFrameMemoryHighWaterMark() const
+	{
+		return m_frameAllocator.getHighWaterMark();
+	}
+
+	inline int World::getSolverIterations() const
+	{
+		return m_solverIterations;
+	}
+
+	inline bool World::getHGridStats(HGridStats* stats) const
+	{
+		if (m_broadphaseType != BroadphaseType::HGRID)
+			return false;
+
+		((const HGrid*)m_broadphase)->getStats(stats);
+		return true;
+	}
 	
 
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "World.h"
+#include "Body.h"
+#include "Collider.h"
+#include <stdio.h>
+#include <string.h>
+
+using namespace ong;
+
+
+// sensors overlapping bodies of other islands must not change the result of the island solver,
+// the positions have to be the same for any number of threads
+
+static const int NUM_PAIRS = 32;
+static const int STACK_HEIGHT = 8;
+static const int NUM_BODIES = NUM_PAIRS * (STACK_HEIGHT + 1);
+static const int NUM_STEPS = 120;
+static const int NUM_RUNS = 16;
+
+struct Result
+{
+	vec3 positions[NUM_BODIES];
+};
+
+static void simulate(int numThreads, Result* result)
+{
+	WorldSettings settings;
+	settings.gravity = vec3(0.0f, -10.0f, 0.0f);
+	settings.numThreads = numThreads;
+	settings.solverMode = SolverMode::ISLANDS;
+	settings.minIterations = 50;
+	settings.maxIterations = 50;
+
+	World world(settings);
+
+	Material m;
+	m.density = 1.0f;
+	m.friction = 0.5f;
+	m.restitution = 0.0f;
+	Material* material = world.createMaterial(m);
+
+	ShapeDescription groundDescr;
+	groundDescr.constructionType = ShapeConstruction::HULL_FROM_BOX;
+	groundDescr.hullFromBox.c = vec3(0.0f, 0.0f, 0.0f);
+	groundDescr.hullFromBox.e = vec3(200.0f, 1.0f, 20.0f);
+
+	ShapeDescription boxDescr;
+	boxDescr.constructionType = ShapeConstruction::HULL_FROM_BOX;
+	boxDescr.hullFromBox.c = vec3(0.0f, 0.0f, 0.0f);
+	boxDescr.hullFromBox.e = vec3(0.5f, 0.5f, 0.5f);
+
+	ShapeDescription sensorDescr;
+	sensorDescr.shapeType = ShapeType::SPHERE;
+	sensorDescr.sphere.c = vec3(0.0f, 0.0f, 0.0f);
+	sensorDescr.sphere.r = 2.5f;
+
+	ColliderDescription cDescr;
+	cDescr.transform.p = vec3(0.0f, 0.0f, 0.0f);
+	cDescr.transform.q = Quaternion(vec3(0.0f, 0.0f, 0.0f), 1.0f);
+	cDescr.material = material;
+	cDescr.isSensor = false;
+
+	BodyDescription bDescr;
+	bDescr.type = BodyType::Static;
+	bDescr.transform.p = vec3(0.0f, -1.0f, 0.0f);
+	bDescr.transform.q = Quaternion(vec3(0.0f, 0.0f, 0.0f), 1.0f);
+	bDescr.linearMomentum = vec3(0.0f, 0.0f, 0.0f);
+	bDescr.angularMomentum = vec3(0.0f, 0.0f, 0.0f);
+
+	cDescr.shape = world.createShape(groundDescr);
+	world.createBody(bDescr)->addCollider(world.createCollider(cDescr));
+
+	ShapePtr box = world.createShape(boxDescr);
+	ShapePtr sensor = world.createShape(sensorDescr);
+
+	// a sliding box next to a stack, they never touch but the sensor of the box overlaps the stack.
+	// the sensor contact links two awake bodies of different islands, the small island finishes
+	// while the stack is still solved
+	Body* bodies[NUM_BODIES];
+	int numBodies = 0;
+	bDescr.type = BodyType::Dynamic;
+	for (int i = 0; i < NUM_PAIRS; ++i)
+	{
+		float x = -100.0f + 6.0f * i;
+
+		bDescr.transform.p = vec3(x, 0.5f, 0.0f);
+		bDescr.linearMomentum = vec3(0.0f, 0.0f, 4.0f);
+
+		Body* body = world.createBody(bDescr);
+
+		cDescr.shape = box;
+		cDescr.isSensor = false;
+		body->addCollider(world.createCollider(cDescr));
+
+		cDescr.shape = sensor;
+		cDescr.isSensor = true;
+		body->addCollider(world.createCollider(cDescr));
+
+		bodies[numBodies++] = body;
+
+		bDescr.linearMomentum = vec3(0.0f, 0.0f, 0.0f);
+		cDescr.shape = box;
+		cDescr.isSensor = false;
+		for (int j = 0; j < STACK_HEIGHT; ++j)
+		{
+			bDescr.transform.p = vec3(x + 2.0f, 0.5f + 1.0f * j, 0.0f);
+
+			body = world.createBody(bDescr);
+			body->addCollider(world.createCollider(cDescr));
+
+			bodies[numBodies++] = body;
+		}
+	}
+
+	for (int i = 0; i < NUM_STEPS; ++i)
+		world.step(1.0f / 60.0f);
+
+	for (int i = 0; i < NUM_BODIES; ++i)
+		result->positions[i] = bodies[i]->getPosition();
+}
+
+int main()
+{
+	Result reference;
+	simulate(1, &reference);
+
+	int failures = 0;
+	for (int run = 0; run < NUM_RUNS; ++run)
+	{
+		Result result;
+		simulate(4, &result);
+
+		if (memcmp(&result, &reference, sizeof(Result)) != 0)
+			failures++;
+	}
+
+	printf("%d of %d runs differ from the single threaded result\n", failures, NUM_RUNS);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+#include "World.h"
+#include "Body.h"
+#include "Collider.h"
+#include <stdio.h>
+#include <float.h>
+#include <vector>
+#include <chrono>
+
+using namespace ong;
+
+
+// compares rays cast one at a time against packets of four,
+// for single bodies and for the whole world on a HGrid
+
+static const int NUM_REPETITIONS = 10;
+static const int WIDTH = 256;
+static const int HEIGHT = 256;
+
+// the fastest of the repetitions in us per ray
+template<typename F>
+static double measure(int numRays, const F& f)
+{
+	double best = DBL_MAX;
+	for (int i = 0; i < NUM_REPETITIONS; ++i)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		f();
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double t = std::chrono::duration<double, std::micro>(end - start).count() / numRays;
+		if (t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+// coherent rays of a camera looking at target
+static void createCameraRays(const vec3& eye, const vec3& target, float fov, std::vector<Ray>* rays)
+{
+	vec3 forward = normalize(target - eye);
+	vec3 right = normalize(cross(vec3(0.0f, 1.0f, 0.0f), forward));
+	vec3 up = cross(forward, right);
+
+	rays->resize(WIDTH * HEIGHT);
+	for (int y = 0; y < HEIGHT; ++y)
+	{
+		for (int x = 0; x < WIDTH; ++x)
+		{
+			Ray& ray = (*rays)[y * WIDTH + x];
+			ray.origin = eye;
+			ray.dir = normalize(forward + fov * ((x - WIDTH / 2) / (float)WIDTH * right + (y - HEIGHT / 2) / (float)HEIGHT * up));
+			ray.tmax = FLT_MAX;
+		}
+	}
+}
+
+static void benchmarkBody(const char* name, Body* body, const std::vector<Ray>& rays)
+{
+	int numRays = (int)rays.size();
+	std::vector<RayQueryResult> single(numRays), packet(numRays);
+
+	double singleTime = measure(numRays, [&]()
+	{
+		for (int i = 0; i < numRays; ++i)
+		{
+			single[i].collider = nullptr;
+			body->queryRay(rays[i].origin, rays[i].dir, &single[i], rays[i].tmax);
+		}
+	});
+
+	double packetTime = measure(numRays, [&]()
+	{
+		for (int i = 0; i < numRays; i += 4)
+		{
+			float tmax[4];
+			for (int k = 0; k < 4; ++k)
+			{
+				packet[i + k].collider = nullptr;
+				tmax[k] = rays[i + k].tmax;
+			}
+			body->queryRays(&rays[i], 4, 0xf, &packet[i], tmax);
+		}
+	});
+
+	int numHits = 0, mismatches = 0;
+	for (int i = 0; i < numRays; ++i)
+	{
+		if (single[i].collider != nullptr)
+			numHits++;
+		if (single[i].collider != packet[i].collider || (single[i].collider != nullptr && single[i].t != packet[i].t))
+			mismatches++;
+	}
+
+	printf("%-10s  %6d  %10.3f  %10.3f  %7.2f  %10d\n", name, numHits, singleTime, packetTime, singleTime / packetTime, mismatches);
+}
+
+int main()
+{
+	WorldSettings settings;
+	settings.numThreads = 1;
+	World world(settings);
+
+	Material m;
+	m.density = 1.0f;
+	m.friction = 0.5f;
+	m.restitution = 0.0f;
+	Material* material = world.createMaterial(m);
+
+	ShapeDescription sphereDescr;
+	sphereDescr.shapeType = ShapeType::SPHERE;
+	sphereDescr.sphere.c = vec3(0.0f, 0.0f, 0.0f);
+	sphereDescr.sphere.r = 0.5f;
+	ShapePtr sphere = world.createShape(sphereDescr);
+
+	ShapeDescription boxDescr;
+	boxDescr.constructionType = ShapeConstruction::HULL_FROM_BOX;
+	boxDescr.hullFromBox.c = vec3(0.0f, 0.0f, 0.0f);
+	boxDescr.hullFromBox.e = vec3(0.5f, 0.5f, 0.5f);
+	ShapePtr box = world.createShape(boxDescr);
+
+	ColliderDescription cDescr;
+	cDescr.transform.p = vec3(0.0f, 0.0f, 0.0f);
+	cDescr.transform.q = Quaternion(vec3(0.0f, 0.0f, 0.0f), 1.0f);
+	cDescr.material = material;
+	cDescr.isSensor = false;
+
+	BodyDescription bDescr;
+	bDescr.type = BodyType::Static;
+	bDescr.transform.q = Quaternion(vec3(0.0f, 0.0f, 0.0f), 1.0f);
+	bDescr.linearMomentum = vec3(0.0f, 0.0f, 0.0f);
+	bDescr.angularMomentum = vec3(0.0f, 0.0f, 0.0f);
+
+	// single bodies in front of the camera
+	std::vector<Ray> rays;
+	createCameraRays(vec3(0.0f, 0.0f, -5.0f), vec3(0.0f, 0.0f, 0.0f), 0.5f, &rays);
+
+	printf("body        hits    single(us)  packet(us)  speedup  mismatches\n");
+
+	bDescr.transform.p = vec3(0.0f, 0.0f, 0.0f);
+	cDescr.shape = sphere;
+	Body* body = world.createBody(bDescr);
+	body->addCollider(world.createCollider(cDescr));
+	benchmarkBody("sphere", body, rays);
+	world.destroyBody(body);
+
+	cDescr.shape = box;
+	body = world.createBody(bDescr);
+	body->addCollider(world.createCollider(cDescr));
+	benchmarkBody("box", body, rays);
+	world.destroyBody(body);
+
+	// a grid of spheres in one body
+	cDescr.shape = sphere;
+	body = world.createBody(bDescr);
+	for (int x = -2; x <= 2; ++x)
+	{
+		for (int y = -2; y <= 2; ++y)
+		{
+			cDescr.transform.p = vec3(0.4f * x, 0.4f * y, 0.0f);
+			body->addCollider(world.createCollider(cDescr));
+		}
+	}
+	benchmarkBody("compound", body, rays);
+	world.destroyBody(body);
+	cDescr.transform.p = vec3(0.0f, 0.0f, 0.0f);
+
+	// a field of spheres and boxes on the HGrid
+	for (int x = 0; x < 20; ++x)
+	{
+		for (int z = 0; z < 20; ++z)
+		{
+			bDescr.transform.p = vec3(2.0f * x - 20.0f, 0.5f * ((x * 7 + z * 3) % 5), 2.0f * z);
+			cDescr.shape = (x + z) % 2 ? sphere : box;
+			world.createBody(bDescr)->addCollider(world.createCollider(cDescr));
+		}
+	}
+	world.step(1.0f / 60.0f);
+
+	createCameraRays(vec3(0.0f, 6.0f, -10.0f), vec3(0.0f, 0.0f, 20.0f), 1.0f, &rays);
+	int numRays = (int)rays.size();
+	std::vector<RayQueryResult> single(numRays), batch(numRays);
+
+	double singleTime = measure(numRays, [&]()
+	{
+		for (int i = 0; i < numRays; ++i)
+		{
+			if (!world.queryRay(rays[i].origin, rays[i].dir, &single[i], rays[i].tmax))
+				single[i].collider = nullptr;
+		}
+	});
+
+	double batchTime = measure(numRays, [&]()
+	{
+		world.queryRays(rays.data(), numRays, batch.data());
+	});
+
+	int numHits = 0, mismatches = 0;
+	for (int i = 0; i < numRays; ++i)
+	{
+		if (single[i].collider != nullptr)
+			numHits++;
+		if (single[i].collider != batch[i].collider || (single[i].collider != nullptr && single[i].t != batch[i].t))
+			mismatches++;
+	}
+
+	printf("\nworld       hits    single(us)  batch(us)   speedup  mismatches\n");
+	printf("%-10s  %6d  %10.3f  %10.3f  %7.2f  %10d\n", "hgrid", numHits, singleTime, batchTime, singleTime / batchTime, mismatches);
+
+	return 0;
+}
@@ -0,0 +1,117 @@
+#include "World.h"
+#include "SAT.h"
+#include <stdio.h>
+#include <chrono>
+
+using namespace ong;
+
+
+// compares the scalar and the simd edge query for hulls of increasing complexity
+
+static const int NUM_TRANSFORMS = 64;
+static const int NUM_REPETITIONS = 200;
+
+static float randomFloat(unsigned int& seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return (seed >> 8) / (float)(1 << 24);
+}
+
+// points on a fibonacci spiral around the unit sphere
+static ShapePtr createHull(World& world, int numPoints)
+{
+	vec3 points[64];
+
+	for (int i = 0; i < numPoints; ++i)
+	{
+		float y = 1.0f - (i + 0.5f) * 2.0f / numPoints;
+		float r = sqrt(1.0f - y * y);
+		float phi = i * 2.39996323f;
+
+		points[i] = vec3(r * cos(phi), y, r * sin(phi));
+	}
+
+	ShapeDescription shapeDescr;
+	shapeDescr.constructionType = ShapeConstruction::HULL_FROM_POINTS;
+	shapeDescr.hullFromPoints.points = points;
+	shapeDescr.hullFromPoints.numPoints = numPoints;
+
+	return world.createShape(shapeDescr);
+}
+
+template<typename F>
+static double measure(const F& f)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < NUM_REPETITIONS; ++i)
+		f();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::micro>(end - start).count() / (NUM_REPETITIONS * NUM_TRANSFORMS);
+}
+
+int main()
+{
+	World world;
+
+	unsigned int seed = 1;
+
+	// overlapping pairs in random orientations
+	Transform transforms[NUM_TRANSFORMS];
+	for (int i = 0; i < NUM_TRANSFORMS; ++i)
+	{
+		vec3 p = 2.0f * vec3(randomFloat(seed), randomFloat(seed), randomFloat(seed)) - vec3(1.0f, 1.0f, 1.0f);
+		vec3 axis = normalize(vec3(randomFloat(seed), randomFloat(seed), randomFloat(seed)) - vec3(0.5f, 0.5f, 0.5f));
+		transforms[i] = Transform(1.5f * p, QuatFromAxisAngle(axis, 6.28318531f * randomFloat(seed)));
+	}
+
+	Transform identity = Transform(vec3(0.0f, 0.0f, 0.0f), Quaternion(vec3(0.0f, 0.0f, 0.0f), 1.0f));
+
+	printf("vertices  edges  scalar(us)  simd(us)  speedup  mismatches\n");
+
+	const int numPoints[] = { 8, 12, 16, 24, 32, 40 };
+	for (int n : numPoints)
+	{
+		ShapePtr shape = createHull(world, n);
+		const Hull* hull = shape;
+
+		int mismatches = 0;
+		for (int i = 0; i < NUM_TRANSFORMS; ++i)
+		{
+			EdgeQuery scalar, simd;
+			queryEdgeDirectionsScalar(hull, &identity, hull, transforms + i, &scalar);
+			queryEdgeDirections(hull, &identity, hull, transforms + i, &simd);
+
+			if (scalar.index1 != simd.index1 || scalar.index2 != simd.index2 || scalar.separation != simd.separation)
+				mismatches++;
+		}
+
+		volatile float sink = 0.0f;
+
+		double scalarTime = measure([&]()
+		{
+			for (int i = 0; i < NUM_TRANSFORMS; ++i)
+			{
+				EdgeQuery query;
+				queryEdgeDirectionsScalar(hull, &identity, hull, transforms + i, &query);
+				sink = sink + query.separation;
+			}
+		});
+
+		double simdTime = measure([&]()
+		{
+			for (int i = 0; i < NUM_TRANSFORMS; ++i)
+			{
+				EdgeQuery query;
+				queryEdgeDirections(hull, &identity, hull, transforms + i, &query);
+				sink = sink + query.separation;
+			}
+		});
+
+		printf("%8d  %5d  %10.2f  %8.2f  %7.2f  %10d\n", hull->numVertices, hull->numEdges / 2, scalarTime, simdTime, scalarTime / simdTime, mismatches);
+
+		world.destroyShape(shape);
+	}
+
+	return 0;
+}
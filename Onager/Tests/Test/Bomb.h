@@ -40,8 +40,7 @@ public:
 
 			world->queryShape(ShapePtr(&s), m_body->getTransform(), callback, m_body);
 			
-			world->destroyBody(m_body);
-			m_body = nullptr;
+			kill();
 			m_lifeTime = 0.0f;
 		}
 	}
@@ -19,9 +19,7 @@ public:
 		
 		if (m_lifeTime < 0)
 		{
-			World* world = m_body->getWorld();
-			world->destroyBody(m_body);
-			m_body = nullptr;
+			kill();
 			m_lifeTime = 0.0f;
 		}
 	}
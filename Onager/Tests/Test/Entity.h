@@ -22,6 +22,19 @@ public:
 		m_hp -= damage; 
 	};
 
+	void kill()
+	{
+		m_hp = 0;
+	}
+
+	// the caller destroys the body, dead bodies are destroyed together
+	Body* releaseBody()
+	{
+		Body* body = m_body;
+		m_body = nullptr;
+		return body;
+	}
+
 	Body* getBody()
 	{
 		return m_body;
@@ -72,6 +72,8 @@ public:
 
 			for (int y = 0; y < m_height; y += 1)
 			{
+				// cast the rays of a row at once
+				int numRays = 0;
 				for (int x = (m_start + y) % m_steps; x < m_width; x += m_steps)
 				{
 					float _x = x / (float)m_width - 0.5f;
@@ -91,11 +93,23 @@ public:
 					vec3 o = view.p;
 					//vec3 o = transformVec3( 10 * vec3(_x, -_y*aspect, 0.1f), view);
 
+					m_rays[numRays].origin = o;
+					m_rays[numRays].dir = dir;
+					m_rays[numRays].tmax = FLT_MAX;
+					numRays++;
+				}
+
+				m_world->queryRays(m_rays, numRays, m_hits);
+
+				int i = 0;
+				for (int x = (m_start + y) % m_steps; x < m_width; x += m_steps, ++i)
+				{
+					const vec3& dir = m_rays[i].dir;
+					const RayQueryResult& result = m_hits[i];
 
 					uint8* pixel = (uint8*)((uint32*)m_pixels + y * m_width + x);
 
-					RayQueryResult result;
-					if (m_world->queryRay(o, dir, &result))
+					if (result.collider != nullptr)
 					{
 						//*pixel = ((int)dot(dir, result.normal) * 255) << 8 | 255;
 
@@ -191,6 +205,9 @@ private:
 
 	uint32 m_pixels[HEIGHT][WIDTH];
 
+	Ray m_rays[WIDTH];
+	RayQueryResult m_hits[WIDTH];
+
 	int m_start = 0;
 	int m_steps = 1;
 
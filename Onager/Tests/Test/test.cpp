@@ -684,6 +684,7 @@ void Test::run()
 		}
 		
 		std::vector<Entity*> deadEntities;
+		std::vector<Body*> deadBodies;
 
 		for (int i = 0; i < m_entities.size(); ++i)
 		{
@@ -693,6 +694,9 @@ void Test::run()
 				if (m_entities[i] == m_player)
 					m_player = 0;
 
+				if (Body* body = m_entities[i]->releaseBody())
+					deadBodies.push_back(body);
+
 				//m_entities[i]->destroy(m_toAdd);
 
 				//delete m_entities[i];
@@ -702,6 +706,10 @@ void Test::run()
 			}
 		}
 
+		// cheaper than destroying the bodies one by one
+		if (!deadBodies.empty())
+			m_world->destroyBodies(deadBodies.data(), deadBodies.size());
+
 		for (Entity* entity : m_toAdd)
 		{
 			m_entities.push_back(entity);